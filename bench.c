@@ -0,0 +1,397 @@
+/* See LICENSE file for license details. */
+#define _XOPEN_SOURCE 500
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <X11/Xlib.h>
+#include "blur.h"
+#include "levels.h"
+#include "stackblur.h"
+#include "threadpool.h"
+
+#include "arg.h"
+#include "util.h"
+
+char *argv0;
+
+/* only blurlevel and pinthreads are used here */
+#include "config.h"
+
+#define MAXLIST 32
+#define LENGTH(X) (sizeof(X) / sizeof((X)[0]))
+
+typedef struct {
+	const char *name;
+	int w, h;
+} Size;
+
+static const Size sizes[] = {
+	{ "1080p", 1920, 1080 },
+	{ "1440p", 2560, 1440 },
+	{ "4k",    3840, 2160 },
+	{ "8k",    7680, 4320 },
+};
+
+typedef struct {
+	uint32_t *data;
+	int w, h;
+} Source;
+
+static void
+die(const char *errstr, ...)
+{
+	va_list ap;
+
+	va_start(ap, errstr);
+	vfprintf(stderr, errstr, ap);
+	va_end(ap);
+	exit(1);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static long
+peakrss(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) < 0)
+		return -1;
+	return ru.ru_maxrss;
+}
+
+static int
+cmpdouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* a comma separated list of numbers in [min, max] */
+static int
+parselist(const char *s, int *v, int min, int max)
+{
+	char *end;
+	long l;
+	int n = 0;
+
+	for (;;) {
+		errno = 0;
+		l = strtol(s, &end, 10);
+		if (errno || end == s || l < min || l > max || n == MAXLIST)
+			return -1;
+		v[n++] = (int)l;
+		if (!*end)
+			return n;
+		if (*end != ',')
+			return -1;
+		s = end + 1;
+	}
+}
+
+/* names from sizes[] or WxH, comma separated */
+static int
+parsesizes(char *s, Size *v)
+{
+	char *tok;
+	int i, n = 0;
+
+	for (tok = strtok(s, ","); tok; tok = strtok(NULL, ",")) {
+		if (n == MAXLIST)
+			return -1;
+		for (i = 0; i < LENGTH(sizes); i++)
+			if (!strcmp(tok, sizes[i].name))
+				break;
+		if (i < LENGTH(sizes)) {
+			v[n] = sizes[i];
+		} else if (sscanf(tok, "%dx%d", &v[n].w, &v[n].h) != 2 ||
+		           v[n].w < 1 || v[n].h < 1) {
+			return -1;
+		} else {
+			v[n].name = tok;
+		}
+		n++;
+	}
+	return n;
+}
+
+static int
+ppmint(FILE *f)
+{
+	int c, n = 0;
+
+	while ((c = getc(f)) == '#' || (c != EOF && strchr(" \t\r\n", c)))
+		if (c == '#')
+			while ((c = getc(f)) != EOF && c != '\n')
+				;
+	if (c < '0' || c > '9')
+		return -1;
+	for (; c >= '0' && c <= '9'; c = getc(f))
+		if ((n = n * 10 + c - '0') > 65535)
+			return -1;
+	return n;
+}
+
+/* binary PPM with 8 bit samples, into ZPixmap 0x00rrggbb pixels */
+static void
+readppm(const char *path, Source *src)
+{
+	FILE *f;
+	unsigned char px[3];
+	int maxval;
+	size_t i;
+
+	if (!(f = fopen(path, "rb")))
+		die("slock-bench: %s: %s\n", path, strerror(errno));
+	if (getc(f) != 'P' || getc(f) != '6' ||
+	    (src->w = ppmint(f)) < 1 || (src->h = ppmint(f)) < 1 ||
+	    (maxval = ppmint(f)) < 1 || maxval > 255)
+		die("slock-bench: %s: not an 8 bit binary PPM\n", path);
+	if (!(src->data = malloc((size_t)src->w * src->h * 4)))
+		die("slock-bench: out of memory\n");
+	for (i = 0; i < (size_t)src->w * src->h; i++) {
+		if (fread(px, 1, 3, f) != 3)
+			die("slock-bench: %s: truncated\n", path);
+		src->data[i] = (uint32_t)px[0] * 255 / maxval << 16 |
+		               (uint32_t)px[1] * 255 / maxval << 8 |
+		               (uint32_t)px[2] * 255 / maxval;
+	}
+	fclose(f);
+}
+
+/* edges and noise, so no engine gets away with flat input */
+static void
+synthetic(Source *src)
+{
+	uint32_t r = 2463534242u;
+	int x, y;
+
+	src->w = 509;
+	src->h = 293;
+	if (!(src->data = malloc((size_t)src->w * src->h * 4)))
+		die("slock-bench: out of memory\n");
+	for (y = 0; y < src->h; y++) {
+		for (x = 0; x < src->w; x++) {
+			r ^= r << 13;
+			r ^= r >> 17;
+			r ^= r << 5;
+			src->data[y * src->w + x] = ((x / 32 + y / 32) & 1) ?
+			    r & 0xffffff : (uint32_t)x * 255 / src->w << 16 |
+			    (uint32_t)y * 255 / src->h << 8 | (r & 0x3f);
+		}
+	}
+}
+
+/* the source repeated to fill the image */
+static void
+fill(XImage *img, const Source *src)
+{
+	uint32_t *row;
+	int x, y;
+
+	for (y = 0; y < img->height; y++) {
+		row = (uint32_t *)(img->data + (size_t)y * img->bytes_per_line);
+		for (x = 0; x < img->width; x += src->w)
+			memcpy(row + x, src->data + (y % src->h) * src->w,
+			       MIN(src->w, img->width - x) * 4);
+	}
+}
+
+static void
+bench(const Source *src, const Size *size, int radius, int scale, int iters)
+{
+	XImage img;
+	char *orig;
+	double *t;
+	size_t len;
+	int i;
+
+	memset(&img, 0, sizeof(img));
+	img.width = size->w;
+	img.height = size->h;
+	img.format = ZPixmap;
+	img.byte_order = LSBFirst;
+	img.bitmap_unit = img.bitmap_pad = 32;
+	img.depth = 24;
+	img.bits_per_pixel = 32;
+	img.bytes_per_line = size->w * 4;
+	img.red_mask = 0xff0000;
+	img.green_mask = 0xff00;
+	img.blue_mask = 0xff;
+	len = (size_t)img.bytes_per_line * img.height;
+	if (!(orig = malloc(len)) || !(img.data = malloc(len)) ||
+	    !(t = malloc(iters * sizeof(double))))
+		die("slock-bench: out of memory\n");
+	fill(&img, src);
+	memcpy(orig, img.data, len);
+
+	/* one untimed run to fault in the pages and warm the caches */
+	blur(&img, 0, 0, img.width, img.height, radius, scale);
+	for (i = 0; i < iters; i++) {
+		/* every run blurs the same picture, as slock would */
+		memcpy(img.data, orig, len);
+		t[i] = now();
+		blur(&img, 0, 0, img.width, img.height, radius, scale);
+		t[i] = now() - t[i];
+	}
+	qsort(t, iters, sizeof(double), cmpdouble);
+
+	printf("%s\t%s\t%s\t%d\t%d\t%u\t%d\t%d\t%.3f\t%.3f\t%.1f\t%ld\n",
+	       blur_enginename(), strcmp(blur_enginename(), "stack") ?
+	       "-" : stackblur_kernelname(),
+	       size->name, img.width, img.height, pool_size(), radius, scale,
+	       t[iters / 2], t[(iters * 99 + 99) / 100 - 1],
+	       (double)img.width * img.height / (t[iters / 2] * 1e3),
+	       peakrss());
+	fflush(stdout);
+
+	free(img.data);
+	free(orig);
+	free(t);
+}
+
+/*
+ * Benches one configuration in a child of its own, so that the peak RSS
+ * it reports is that of this configuration rather than of the largest
+ * one run before it.
+ */
+static void
+run(const Source *src, const char *engine, int threads, const Size *size,
+    int radius, int scale, int iters)
+{
+	int status;
+	pid_t pid;
+
+	fflush(stdout);
+	switch ((pid = fork())) {
+	case -1:
+		die("slock-bench: fork: %s\n", strerror(errno));
+	case 0:
+		/* 0 is one per usable CPU, as in slock */
+		if (pool_init(threads, pinthreads) < 0)
+			die("slock-bench: cannot start %d threads\n", threads);
+		blur_setengine(engine);
+		bench(src, size, radius, scale, iters);
+		pool_destroy();
+		exit(0);
+	}
+	/* the child has said what went wrong */
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		exit(1);
+}
+
+static void
+usage(void)
+{
+	die("usage: slock-bench [-e engines] [-k kernel] [-s sizes] "
+	    "[-r radii] [-t threads] [-S scale] [-n iterations] [-i ppm]\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	Source src;
+	Size size[MAXLIST];
+	const char *engine[MAXLIST], *ppm = NULL;
+	char *tok;
+	int radius[MAXLIST], threads[MAXLIST], v[MAXLIST];
+	int nengines, nsizes, nradii, nthreads, scale = 1, iters = 20;
+	int e, s, r, t;
+
+	for (nengines = 0; blur_engines[nengines].name; nengines++)
+		engine[nengines] = blur_engines[nengines].name;
+	nsizes = LENGTH(sizes);
+	memcpy(size, sizes, sizeof(sizes));
+	for (nradii = 0; nradii < NUMLEVELS; nradii++)
+		radius[nradii] = blurlevel[nradii];
+	radius[nradii++] = 8;
+	radius[nradii++] = 128;
+	threads[0] = 1;
+	threads[1] = 0;
+	nthreads = 2;
+
+	ARGBEGIN {
+	case 'e':
+		nengines = 0;
+		for (tok = strtok(EARGF(usage()), ","); tok;
+		     tok = strtok(NULL, ",")) {
+			if (blur_setengine(tok) < 0)
+				die("slock-bench: unknown engine %s\n", tok);
+			if (nengines == MAXLIST)
+				usage();
+			engine[nengines++] = tok;
+		}
+		if (!nengines)
+			usage();
+		break;
+	case 'k':
+		if (stackblur_setkernel(EARGF(usage())) < 0)
+			die("slock-bench: unknown or unsupported kernel\n");
+		break;
+	case 's':
+		if ((nsizes = parsesizes(EARGF(usage()), size)) < 1)
+			usage();
+		break;
+	case 'r':
+		if ((nradii = parselist(EARGF(usage()), radius, 1,
+		                        STACKBLUR_MAXRADIUS)) < 0)
+			usage();
+		break;
+	case 't':
+		if ((nthreads = parselist(EARGF(usage()), threads, 0,
+		                          POOL_MAXTHREADS)) < 0)
+			usage();
+		break;
+	case 'S':
+		if (parselist(EARGF(usage()), v, 0, BLUR_SCALELIMIT) != 1)
+			usage();
+		scale = v[0];
+		break;
+	case 'n':
+		if (parselist(EARGF(usage()), v, 1, 100000) != 1)
+			usage();
+		iters = v[0];
+		break;
+	case 'i':
+		ppm = EARGF(usage());
+		break;
+	default:
+		usage();
+	} ARGEND;
+	if (argc)
+		usage();
+
+	if (ppm)
+		readppm(ppm, &src);
+	else
+		synthetic(&src);
+
+	printf("engine\tkernel\tsize\twidth\theight\tthreads\tradius\tscale\t"
+	       "median_ms\tp99_ms\tmpixels_s\tpeak_rss_kb\n");
+	for (t = 0; t < nthreads; t++)
+		for (e = 0; e < nengines; e++)
+			for (s = 0; s < nsizes; s++)
+				for (r = 0; r < nradii; r++)
+					run(&src, engine[e], threads[t],
+					    &size[s], radius[r], scale, iters);
+	free(src.data);
+
+	return 0;
+}
@@ -0,0 +1,501 @@
+/* See LICENSE file for license details. */
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blur.h"
+#include "stackblur.h"
+#include "threadpool.h"
+#include "trace.h"
+
+/*
+ * A blur of radius r mostly throws away detail finer than r pixels, so
+ * for large radii it is much cheaper to blur a smaller copy: box-filter
+ * the region down by an integer factor, blur that with r / factor and
+ * scale it back up bilinearly.  At 4K with the default radii this cuts
+ * the blur work by 4-16 times for a result that looks the same.
+ */
+
+typedef struct {
+	XImage *image, *small;
+	const StackBlurFormat *fmt;  /* of image, NULL for BLUR_8888 */
+	int x, y, w, h, scale;
+	int *x0, *x1, *wx;  /* bilinear source columns and weights */
+	int tiles, next;
+	int screen;
+} ScaleJob;
+
+static uint32_t *
+pixel(XImage *img, int x, int y)
+{
+	return (uint32_t *)(img->data + (size_t)y * img->bytes_per_line) + x;
+}
+
+/* row y of the region being scaled */
+static unsigned char *
+regionrow(ScaleJob *job, int y)
+{
+	XImage *img = job->image;
+
+	return (unsigned char *)img->data +
+	       (size_t)(job->y + y) * img->bytes_per_line +
+	       (size_t)job->x * img->bits_per_pixel / 8;
+}
+
+/*
+ * The scaling passes work on whole 32 bit pixels, two channels per word
+ * in 16 bit fields (0x00ff00ff and 0xff00ff00 halves), so that every
+ * add and multiply handles two channels without carrying into the next.
+ * The row loops take four pixels at a time in GCC vector types, which
+ * become plain SSE2 or NEON even at -Os.
+ */
+typedef uint32_t V4 __attribute__((vector_size(16)));
+typedef uint16_t V8 __attribute__((vector_size(16)));
+
+/* adds the channels of the n pixels in s to the column sums rb and ga */
+static void
+sumrow(uint32_t *rb, uint32_t *ga, const uint32_t *s, int n)
+{
+	V4 v, vrb, vga;
+	int x;
+
+	for (x = 0; x + 4 <= n; x += 4) {
+		memcpy(&v, s + x, sizeof(v));
+		memcpy(&vrb, rb + x, sizeof(vrb));
+		memcpy(&vga, ga + x, sizeof(vga));
+		vrb += v & 0xff00ff;
+		vga += v >> 8 & 0xff00ff;
+		memcpy(rb + x, &vrb, sizeof(vrb));
+		memcpy(ga + x, &vga, sizeof(vga));
+	}
+	for (; x < n; x++) {
+		rb[x] += s[x] & 0xff00ff;
+		ga[x] += s[x] >> 8 & 0xff00ff;
+	}
+}
+
+/*
+ * Other formats are read and written through a row of BLUR_8888 words,
+ * so the small copy is always BLUR_8888 and blurred by the fast kernels.
+ */
+static void
+downjob(void *arg, unsigned int id, unsigned int n)
+{
+	ScaleJob *job = arg;
+	uint32_t *rb, *ga, *d, *row = NULL, *s, srb, sga;
+	int t, sx, sy, x, y, y2, i, cnt, rows, sw = job->small->width;
+	uint64_t start = trace_now();
+
+	/* up to 16 x 16 channel values of 255 still fit a 16 bit field */
+	rb = malloc(job->w * sizeof(uint32_t));
+	ga = malloc(job->w * sizeof(uint32_t));
+	if (!rb || !ga ||
+	    (job->fmt && !(row = malloc(job->w * sizeof(uint32_t)))))
+		goto out;
+	while ((t = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+	       job->tiles) {
+		for (sy = t * BLUR_TILEROWS;
+		     sy < MIN((t + 1) * BLUR_TILEROWS, job->small->height); sy++) {
+			memset(rb, 0, job->w * sizeof(uint32_t));
+			memset(ga, 0, job->w * sizeof(uint32_t));
+			y2 = MIN((sy + 1) * job->scale, job->h);
+			for (y = sy * job->scale; y < y2; y++) {
+				if (job->fmt) {
+					job->fmt->unpack(row, regionrow(job, y),
+					                 job->w);
+					s = row;
+				} else {
+					s = (uint32_t *)regionrow(job, y);
+				}
+				sumrow(rb, ga, s, job->w);
+			}
+			rows = y2 - sy * job->scale;
+			d = pixel(job->small, 0, sy);
+			for (x = 0, sx = 0; sx < sw; sx++) {
+				srb = sga = 0;
+				cnt = MIN(job->scale, job->w - x);
+				for (i = cnt; i > 0; i--, x++) {
+					srb += rb[x];
+					sga += ga[x];
+				}
+				cnt *= rows;
+				d[sx] = 0xff000000 |
+				        ((srb >> 16) + cnt / 2) / cnt << 16 |
+				        ((sga & 0xffff) + cnt / 2) / cnt << 8 |
+				        ((srb & 0xffff) + cnt / 2) / cnt;
+			}
+		}
+	}
+out:
+	free(rb);
+	free(ga);
+	free(row);
+	trace_add("down", job->screen, TRACE_WORKER + id, start);
+}
+
+/* (a * (256 - w) + b * w) / 256 on all four channels */
+static uint32_t
+lerp(uint32_t a, uint32_t b, unsigned int w)
+{
+	uint32_t rb, ga;
+
+	rb = ((a & 0xff00ff) * (256 - w) + (b & 0xff00ff) * w + 0x800080) >> 8;
+	ga = (a >> 8 & 0xff00ff) * (256 - w) + (b >> 8 & 0xff00ff) * w + 0x800080;
+	return (rb & 0xff00ff) | (ga & 0xff00ff00);
+}
+
+/* lerp() of the n pixel rows a and b into d, made opaque */
+static void
+lerprow(uint32_t *d, const uint32_t *a, const uint32_t *b, int n,
+        unsigned int w)
+{
+	V4 va, vb, vd;
+	V8 rb, ga;
+	int x;
+
+	/* one channel per 16 bit lane, 255 * 256 + 128 still fits */
+	for (x = 0; x + 4 <= n; x += 4) {
+		memcpy(&va, a + x, sizeof(va));
+		memcpy(&vb, b + x, sizeof(vb));
+		rb = ((V8)(va & 0xff00ff) * (uint16_t)(256 - w) +
+		      (V8)(vb & 0xff00ff) * (uint16_t)w + 0x80) >> 8;
+		ga = ((V8)(va >> 8 & 0xff00ff) * (uint16_t)(256 - w) +
+		      (V8)(vb >> 8 & 0xff00ff) * (uint16_t)w + 0x80) & 0xff00;
+		vd = (V4)rb | (V4)ga | 0xff000000;
+		memcpy(d + x, &vd, sizeof(vd));
+	}
+	for (; x < n; x++)
+		d[x] = lerp(a[x], b[x], w) | 0xff000000;
+}
+
+/* maps destination coordinate i to the source pair *a, *b and weight of *b */
+static void
+bilinear(int i, int scale, int max, int *a, int *b, int *wb)
+{
+	/* centre of i in 8 bit fixed point source coordinates */
+	int f = ((2 * i + 1) << 8) / (2 * scale) - 128;
+
+	if (f < 0)
+		f = 0;
+	*a = MIN(f >> 8, max);
+	*b = MIN(*a + 1, max);
+	*wb = f & 0xff;
+}
+
+/* source row sy scaled up horizontally */
+static void
+hscale(ScaleJob *job, int sy, uint32_t *row)
+{
+	uint32_t *s = pixel(job->small, 0, sy);
+	int x;
+
+	for (x = 0; x < job->w; x++)
+		row[x] = lerp(s[job->x0[x]], s[job->x1[x]], job->wx[x]);
+}
+
+static void
+upjob(void *arg, unsigned int id, unsigned int n)
+{
+	ScaleJob *job = arg;
+	uint32_t *top, *bot, *tmp, *row = NULL;
+	int t, y, y0, y1, wy, cy0, cy1;
+	uint64_t start = trace_now();
+
+	top = malloc(job->w * sizeof(uint32_t));
+	bot = malloc(job->w * sizeof(uint32_t));
+	if (!top || !bot ||
+	    (job->fmt && !(row = malloc(job->w * sizeof(uint32_t)))))
+		goto out;
+	while ((t = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) <
+	       job->tiles) {
+		/* each source row pair serves scale destination rows */
+		cy0 = cy1 = -1;
+		for (y = t * BLUR_TILEROWS;
+		     y < MIN((t + 1) * BLUR_TILEROWS, job->h); y++) {
+			bilinear(y, job->scale, job->small->height - 1,
+			         &y0, &y1, &wy);
+			if (y0 == cy1) {
+				tmp = top;
+				top = bot;
+				bot = tmp;
+				cy1 = cy0;
+				cy0 = y0;
+			}
+			if (y0 != cy0)
+				hscale(job, cy0 = y0, top);
+			if (y1 != cy1)
+				hscale(job, cy1 = y1, bot);
+			if (!job->fmt) {
+				lerprow((uint32_t *)regionrow(job, y), top, bot,
+				        job->w, wy);
+				continue;
+			}
+			lerprow(row, top, bot, job->w, wy);
+			job->fmt->pack(regionrow(job, y), row, job->w);
+		}
+	}
+out:
+	free(top);
+	free(bot);
+	free(row);
+	trace_add("up", job->screen, TRACE_WORKER + id, start);
+}
+
+const BlurEngine blur_engines[] = {
+	{ "stack", stackblur },
+	{ "box",   boxblur },
+	{ "iir",   iirblur },
+	{ NULL,    NULL }
+};
+
+static const BlurEngine *engine = &blur_engines[0];
+
+int
+blur_setengine(const char *name)
+{
+	const BlurEngine *e;
+
+	for (e = blur_engines; e->name; e++) {
+		if (!strcmp(e->name, name)) {
+			engine = e;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* a whole byte of a 32 bit pixel */
+static int
+bytemask(unsigned long m)
+{
+	return m == 0xff || m == 0xff00 || m == 0xff0000 || m == 0xff000000;
+}
+
+int
+blur_format(const XImage *image)
+{
+	unsigned long r = image->red_mask, g = image->green_mask;
+	unsigned long b = image->blue_mask, m = r | g | b;
+	int msb = image->byte_order == MSBFirst;
+
+	if (image->format != ZPixmap)
+		return BLUR_UNSUPPORTED;
+	switch (image->bits_per_pixel) {
+	case 16:
+		if (g == 0x7e0 && m == 0xffff && (r == 0xf800 || r == 0x1f))
+			return msb ? BLUR_565BE : BLUR_565LE;
+		break;
+	case 32:
+		/* images made without a visual have no masks */
+		if (!m && image->depth <= 24)
+			return msb ? BLUR_X888 : BLUR_8888;
+		if (bytemask(r) && bytemask(g) && bytemask(b)) {
+			if (m == 0xffffff)
+				return msb ? BLUR_X888 : BLUR_8888;
+			if (m == 0xffffff00)
+				return msb ? BLUR_8888 : BLUR_X888;
+		}
+		if (g == 0xffc00 && m == 0x3fffffff &&
+		    (r == 0x3ff00000 || r == 0x3ff))
+			return msb ? BLUR_2101010BE : BLUR_2101010LE;
+		break;
+	}
+	return BLUR_UNSUPPORTED;
+}
+
+const char *
+blur_enginename(void)
+{
+	return engine->name;
+}
+
+double
+blur_sigma(int radius)
+{
+	/* the stack blur kernel is a tent of two boxes of radius + 1 */
+	return sqrt(radius * (radius + 2) / 6.0);
+}
+
+typedef struct {
+	XImage *image;
+	int x, y, w, h;
+	BlurLine fn;
+	const void *arg;
+	size_t scratch;
+	int htiles, vtiles, hnext, vnext;
+	int screen;
+} LineJob;
+
+/*
+ * Rows are blurred where they lie.  Columns are copied out a block of
+ * BLUR_COLBLOCK at a time, so each image row is touched once per block
+ * instead of once per column, blurred as contiguous lines and copied back.
+ */
+static void
+linejob(void *arg, unsigned int id, unsigned int n)
+{
+	LineJob *job = arg;
+	uint32_t *cols, *row;
+	void *scratch;
+	int t, y, y2, x, x2, c, nc;
+	uint64_t start = trace_now();
+
+	scratch = malloc(MAX(job->w, job->h) * job->scratch);
+	cols = malloc((size_t)job->h * BLUR_COLBLOCK * sizeof(uint32_t));
+	/* leave the tiles to the other threads if this one has no memory */
+	while (scratch && cols &&
+	       (t = __atomic_fetch_add(&job->hnext, 1, __ATOMIC_RELAXED)) <
+	       job->htiles) {
+		y2 = MIN((t + 1) * BLUR_TILEROWS, job->h);
+		for (y = t * BLUR_TILEROWS; y < y2; y++)
+			job->fn(pixel(job->image, job->x, job->y + y), job->w,
+			        scratch, job->arg);
+	}
+	trace_add("hpass", job->screen, TRACE_WORKER + id, start);
+	pool_barrier();
+	start = trace_now();
+	while (scratch && cols &&
+	       (t = __atomic_fetch_add(&job->vnext, 1, __ATOMIC_RELAXED)) <
+	       job->vtiles) {
+		x = t * BLUR_COLBLOCK;
+		x2 = MIN(x + BLUR_COLBLOCK, job->w);
+		nc = x2 - x;
+		for (y = 0; y < job->h; y++) {
+			row = pixel(job->image, job->x + x, job->y + y);
+			for (c = 0; c < nc; c++)
+				cols[c * job->h + y] = row[c];
+		}
+		for (c = 0; c < nc; c++)
+			job->fn(cols + c * job->h, job->h, scratch, job->arg);
+		for (y = 0; y < job->h; y++) {
+			row = pixel(job->image, job->x + x, job->y + y);
+			for (c = 0; c < nc; c++)
+				row[c] = cols[c * job->h + y];
+		}
+	}
+	trace_add("vpass", job->screen, TRACE_WORKER + id, start);
+	free(scratch);
+	free(cols);
+}
+
+void
+blur_lines(XImage *image, int x, int y, int w, int h, BlurLine fn,
+           const void *arg, size_t scratch)
+{
+	LineJob job;
+
+	if (w < 1 || h < 1)
+		return;
+	job.image = image;
+	job.x = x;
+	job.y = y;
+	job.w = w;
+	job.h = h;
+	job.fn = fn;
+	job.arg = arg;
+	job.scratch = scratch;
+	job.htiles = (h + BLUR_TILEROWS - 1) / BLUR_TILEROWS;
+	job.vtiles = (w + BLUR_COLBLOCK - 1) / BLUR_COLBLOCK;
+	job.hnext = job.vnext = 0;
+	job.screen = trace_screen();
+	pool_run(linejob, &job);
+}
+
+/* the engine, or stackblur() for formats the engine cannot read */
+static void
+fullblur(XImage *image, int fmt, int x, int y, int w, int h, int radius)
+{
+	if (fmt != BLUR_8888 && engine->blur != stackblur)
+		stackblur(image, x, y, w, h, radius);
+	else
+		engine->blur(image, x, y, w, h, radius);
+}
+
+/* rather than leave a format that cannot be blurred readable */
+static void
+blank(XImage *image, int x, int y, int w, int h)
+{
+	size_t lo = (size_t)x * image->bits_per_pixel / 8;
+	size_t hi = ((size_t)(x + w) * image->bits_per_pixel + 7) / 8;
+	int i;
+
+	for (i = y; i < y + h; i++)
+		memset(image->data + (size_t)i * image->bytes_per_line + lo, 0,
+		       hi - lo);
+}
+
+void
+blur(XImage *image, int x, int y, int w, int h, int radius, int scale)
+{
+	XImage small;
+	ScaleJob job;
+	int i, fmt;
+
+	if (radius < 1 || w < 1 || h < 1)
+		return;
+	if ((fmt = blur_format(image)) < 0) {
+		blank(image, x, y, w, h);
+		return;
+	}
+	if (scale < 1)
+		scale = blur_scale(radius);
+	scale = MIN(scale, BLUR_SCALELIMIT);
+	if (scale == 1) {
+		fullblur(image, fmt, x, y, w, h, radius);
+		return;
+	}
+
+	small = *image;
+	small.width = (w + scale - 1) / scale;
+	small.height = (h + scale - 1) / scale;
+	small.bytes_per_line = small.width * 4;
+	small.bits_per_pixel = 32;
+	small.depth = 24;
+	small.byte_order = LSBFirst;
+	small.red_mask = 0xff0000;
+	small.green_mask = 0xff00;
+	small.blue_mask = 0xff;
+	job.x0 = malloc(w * sizeof(int));
+	job.x1 = malloc(w * sizeof(int));
+	job.wx = malloc(w * sizeof(int));
+	if (!(small.data = malloc((size_t)small.bytes_per_line * small.height)) ||
+	    !job.x0 || !job.x1 || !job.wx) {
+		/* not worth failing the lock over */
+		free(small.data);
+		free(job.x0);
+		free(job.x1);
+		free(job.wx);
+		fullblur(image, fmt, x, y, w, h, radius);
+		return;
+	}
+	for (i = 0; i < w; i++)
+		bilinear(i, scale, small.width - 1, &job.x0[i], &job.x1[i],
+		         &job.wx[i]);
+
+	job.image = image;
+	job.small = &small;
+	job.fmt = fmt == BLUR_8888 ? NULL : &stackblur_formats[fmt];
+	job.x = x;
+	job.y = y;
+	job.w = w;
+	job.h = h;
+	job.scale = scale;
+	job.screen = trace_screen();
+
+	job.tiles = (small.height + BLUR_TILEROWS - 1) / BLUR_TILEROWS;
+	job.next = 0;
+	pool_run(downjob, &job);
+
+	engine->blur(&small, 0, 0, small.width, small.height,
+	             MAX(radius / scale, 1));
+
+	job.tiles = (h + BLUR_TILEROWS - 1) / BLUR_TILEROWS;
+	job.next = 0;
+	pool_run(upjob, &job);
+
+	free(small.data);
+	free(job.x0);
+	free(job.x1);
+	free(job.wx);
+}
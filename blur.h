@@ -0,0 +1,92 @@
+/* See LICENSE file for license details. */
+#ifndef BLUR_H__
+#define BLUR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <X11/Xlib.h>
+
+/* never pick a factor above this, nor shrink below this radius */
+#define BLUR_MAXSCALE  8
+#define BLUR_MINRADIUS 8
+/* largest factor asked for explicitly, e.g. for a quick preview */
+#define BLUR_SCALELIMIT 16
+
+/* rows per tile in the scaling passes and horizontal line passes */
+#define BLUR_TILEROWS  16
+/* columns per tile in the vertical line passes */
+#define BLUR_COLBLOCK  16
+
+/*
+ * Pixel layouts blur() works on natively, by where the channels sit in
+ * memory; channels are blurred alike, so their colours do not matter.
+ */
+enum {
+	BLUR_UNSUPPORTED = -1,
+	BLUR_8888,      /* 8 bit channels in bytes 0-2 (BGRA, RGBX) */
+	BLUR_X888,      /* 8 bit channels in bytes 1-3 (ARGB, XBGR) */
+	BLUR_565LE,     /* 5-6-5 in 16 bit words stored LSB first */
+	BLUR_565BE,
+	BLUR_2101010LE, /* 10 bit channels under 2 pad bits, 32 bit words */
+	BLUR_2101010BE,
+	BLUR_NFORMATS
+};
+
+typedef struct {
+	const char *name;
+	void (*blur)(XImage *image, int x, int y, int w, int h, int radius);
+} BlurEngine;
+
+/* NULL terminated, the first one is the default */
+extern const BlurEngine blur_engines[];
+
+int blur_format(const XImage *image);
+int blur_setengine(const char *name);
+const char *blur_enginename(void);
+
+/*
+ * The factor blur() shrinks by for radius when asked for scale 0.  Here
+ * rather than in blur.c, as mkradii works out from it which radii the
+ * configuration ends up blurring with.
+ */
+static inline int
+blur_scale(int radius)
+{
+	int scale = 1;
+
+	while (scale < BLUR_MAXSCALE && radius / (scale * 2) >= BLUR_MINRADIUS)
+		scale *= 2;
+	return scale;
+}
+
+/* standard deviation of the Gaussian the stack blur of radius mimics */
+double blur_sigma(int radius);
+
+/*
+ * Blurs the n pixels of line in place.  scratch holds n times the
+ * per pixel scratch size passed to blur_lines().
+ */
+typedef void (*BlurLine)(uint32_t *line, int n, void *scratch,
+                         const void *arg);
+
+/*
+ * Runs fn over every row and then every column of the region on the
+ * thread pool, for separable engines that work on one line at a time.
+ */
+void blur_lines(XImage *image, int x, int y, int w, int h, BlurLine fn,
+                const void *arg, size_t scratch);
+
+void boxblur(XImage *image, int x, int y, int w, int h, int radius);
+void iirblur(XImage *image, int x, int y, int w, int h, int radius);
+
+/*
+ * Blurs the w x h region at x, y of image.  With scale > 1 the region is
+ * box-filtered down by that factor, blurred with radius / scale and
+ * bilinearly scaled back up; scale 0 picks the factor with blur_scale().
+ * The blurring itself is done by the engine set with blur_setengine(),
+ * or by stackblur() for formats other than BLUR_8888 the engine cannot
+ * handle.  Formats blur_format() does not know are blanked.
+ */
+void blur(XImage *image, int x, int y, int w, int h, int radius, int scale);
+
+#endif
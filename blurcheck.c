@@ -0,0 +1,548 @@
+/* See LICENSE file for license details. */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <X11/Xlib.h>
+#include "blur.h"
+#include "stackblur.h"
+#include "threadpool.h"
+
+#include "arg.h"
+#include "util.h"
+
+char *argv0;
+
+#define MAXLIST 32
+
+/*
+ * A way of blurring that has to match a reference bit for bit.  The
+ * stack blur paths are held against the scalar HStackRenderingThread
+ * and VStackRenderingThread run over the whole region on one thread,
+ * for the formats with channels of at most 8 bits after moving them
+ * into the bytes those read, and the 10 bit formats against the blur
+ * written out as plain sums.  Engines without such a reference and the
+ * downscaled blur are held against themselves blurring a packed copy of
+ * the region with no workers, which catches tiling, threading and
+ * offset bugs.
+ */
+typedef struct {
+	const char *engine;
+	const char *kernel;
+	int scale;
+	int format;
+} Path;
+
+/*
+ * Box and IIR only approximate the stack blur, and the downscaled blur
+ * the full size one, so they are also held against the stack reference
+ * within a tolerance.  Only pixels at least radius in from the region's
+ * edges count, because each engine handles the edges its own way.  No
+ * channel there may be further off than this many levels of 8 bits.
+ * On top of that, each side may round to the format's narrowest channel
+ * once, so two of its steps are allowed as well.  Box and IIR only
+ * face it from APPROXRADIUS on; below that they fit the small tent too
+ * coarsely.  The downscaled blur only faces it at factors blur_scale()
+ * picks for the radius, not the coarser ones a preview asks for.
+ */
+#define ENGINETOLERANCE 12
+#define SCALETOLERANCE  4
+#define APPROXRADIUS    5
+
+static uint32_t seed = 1;
+static unsigned long ncompared, nfailed;
+
+static void
+die(const char *errstr, ...)
+{
+	va_list ap;
+
+	va_start(ap, errstr);
+	vfprintf(stderr, errstr, ap);
+	va_end(ap);
+	exit(1);
+}
+
+static uint32_t
+rnd(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+/* uniform in [lo, hi] */
+static int
+between(int lo, int hi)
+{
+	return lo + rnd() % (hi - lo + 1);
+}
+
+static int
+parselist(const char *s, int *v, int min, int max)
+{
+	char *end;
+	long l;
+	int n = 0;
+
+	for (;;) {
+		errno = 0;
+		l = strtol(s, &end, 10);
+		if (errno || end == s || l < min || l > max || n == MAXLIST)
+			return -1;
+		v[n++] = (int)l;
+		if (!*end)
+			return n;
+		if (*end != ',')
+			return -1;
+		s = end + 1;
+	}
+}
+
+/* a w x h image of format with bpl bytes per line */
+static void
+newimage(XImage *img, int format, int w, int h, int bpl)
+{
+	memset(img, 0, sizeof(*img));
+	img->width = w;
+	img->height = h;
+	img->format = ZPixmap;
+	img->bitmap_unit = img->bitmap_pad = 32;
+	img->bytes_per_line = bpl;
+	switch (format) {
+	case BLUR_565LE:
+	case BLUR_565BE:
+		img->depth = img->bits_per_pixel = 16;
+		img->red_mask = 0xf800;
+		img->green_mask = 0x7e0;
+		img->blue_mask = 0x1f;
+		break;
+	case BLUR_2101010LE:
+	case BLUR_2101010BE:
+		img->depth = 30;
+		img->bits_per_pixel = 32;
+		img->red_mask = 0x3ff00000;
+		img->green_mask = 0xffc00;
+		img->blue_mask = 0x3ff;
+		break;
+	default:
+		img->depth = 24;
+		img->bits_per_pixel = 32;
+		img->red_mask = 0xff0000;
+		img->green_mask = 0xff00;
+		img->blue_mask = 0xff;
+		break;
+	}
+	img->byte_order = format == BLUR_X888 || format == BLUR_565BE ||
+	                  format == BLUR_2101010BE ? MSBFirst : LSBFirst;
+	if (!(img->data = malloc((size_t)bpl * h)))
+		die("slock-blurcheck: out of memory\n");
+}
+
+/* the w x h region at x, y of src as a packed image */
+static void
+crop(XImage *dst, const XImage *src, int format, int x, int y, int w, int h)
+{
+	int i, bpp = src->bits_per_pixel / 8;
+
+	newimage(dst, format, w, h, w * bpp);
+	for (i = 0; i < h; i++)
+		memcpy(dst->data + (size_t)i * w * bpp, src->data +
+		       (size_t)(y + i) * src->bytes_per_line + x * bpp, w * bpp);
+}
+
+/* the scalar passes, set up as stackblur() does but on one thread */
+static void
+reference(XImage *img, int radius, int bits)
+{
+	StackBlurRenderingParams rp;
+	int i, w = img->width, h = img->height;
+
+	radius = MIN(radius, STACKBLUR_MAXRADIUS);
+	rp.vminx = malloc(w * sizeof(int));
+	rp.vminy = malloc(h * sizeof(int));
+	if (!rp.vminx || !rp.vminy)
+		die("slock-blurcheck: out of memory\n");
+	for (i = 0; i < w; i++)
+		rp.vminx[i] = MIN(i + radius + 1, w - 1);
+	for (i = 0; i < h; i++)
+		rp.vminy[i] = MIN(i + radius + 1, h - 1) * w;
+	rp.pix = (unsigned char *)img->data;
+	rp.x = rp.y = 0;
+	rp.x2 = rp.w = w;
+	rp.y2 = rp.H = h;
+	rp.wm = w - 1;
+	rp.radius = radius;
+	stackblur_normbits(radius, bits, &rp.mul, &rp.shr);
+	HStackRenderingThread(&rp);
+	VStackRenderingThread(&rp);
+	free(rp.vminx);
+	free(rp.vminy);
+}
+
+/*
+ * The n values step apart at v blurred as a sum of each with its
+ * neighbours weighted radius + 1 - distance, the ends repeated, and
+ * normalised as the passes do.  Shares nothing with them but the norm.
+ */
+static void
+plainline(int *v, int n, int step, int radius, int bits, int *tmp)
+{
+	unsigned int mul, sum;
+	int shr, i, j;
+
+	stackblur_normbits(radius, bits, &mul, &shr);
+	for (i = 0; i < n; i++) {
+		sum = 0;
+		for (j = -radius; j <= radius; j++)
+			sum += v[MIN(MAX(i + j, 0), n - 1) * step] *
+			       (radius + 1 - abs(j));
+		tmp[i] = (uint64_t)sum * mul >> shr;
+	}
+	for (i = 0; i < n; i++)
+		v[i * step] = tmp[i];
+}
+
+/* the 10 bit formats, too wide for the bytes reference() works on */
+static void
+widereference(XImage *img, int format, int radius)
+{
+	unsigned char *p;
+	unsigned int v;
+	int *c, *tmp, i, k, w = img->width, h = img->height, n = w * h;
+
+	radius = MIN(radius, STACKBLUR_MAXRADIUS);
+	c = malloc(3 * n * sizeof(int));
+	tmp = malloc(MAX(w, h) * sizeof(int));
+	if (!c || !tmp)
+		die("slock-blurcheck: out of memory\n");
+	for (i = 0; i < n; i++) {
+		p = (unsigned char *)img->data + i * 4;
+		v = format == BLUR_2101010LE ?
+		    p[0] | p[1] << 8 | p[2] << 16 | (unsigned int)p[3] << 24 :
+		    (unsigned int)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+		for (k = 0; k < 3; k++)
+			c[k * n + i] = v >> (20 - 10 * k) & 0x3ff;
+	}
+	for (k = 0; k < 3; k++) {
+		for (i = 0; i < h; i++)
+			plainline(c + k * n + i * w, w, 1, radius, 10, tmp);
+		for (i = 0; i < w; i++)
+			plainline(c + k * n + i, h, w, radius, 10, tmp);
+	}
+	for (i = 0; i < n; i++) {
+		p = (unsigned char *)img->data + i * 4;
+		v = 3U << 30 | c[i] << 20 | c[n + i] << 10 | c[2 * n + i];
+		for (k = 0; k < 4; k++)
+			p[format == BLUR_2101010LE ? k : 3 - k] = v >> 8 * k;
+	}
+	free(tmp);
+	free(c);
+}
+
+/*
+ * reference() for formats with narrower or moved channels: they go
+ * into bytes 0-2 of a BLUR_8888 image unwidened, are blurred there and
+ * go back, pad bits set.  10 bit channels take widereference().
+ */
+static void
+channelreference(XImage *img, int format, int radius)
+{
+	XImage tmp;
+	unsigned char *p, *q;
+	unsigned int v;
+	int i, n = img->width * img->height;
+
+	if (format == BLUR_2101010LE || format == BLUR_2101010BE) {
+		widereference(img, format, radius);
+		return;
+	}
+	newimage(&tmp, BLUR_8888, img->width, img->height, img->width * 4);
+	for (i = 0; i < n; i++) {
+		p = (unsigned char *)img->data + i * img->bits_per_pixel / 8;
+		q = (unsigned char *)tmp.data + i * 4;
+		if (format == BLUR_X888) {
+			memcpy(q, p + 1, 3);
+			continue;
+		}
+		v = format == BLUR_565LE ? p[0] | p[1] << 8 : p[0] << 8 | p[1];
+		q[0] = v >> 11;
+		q[1] = v >> 5 & 0x3f;
+		q[2] = v & 0x1f;
+	}
+	reference(&tmp, radius, format == BLUR_X888 ? 8 : 6);
+	for (i = 0; i < n; i++) {
+		p = (unsigned char *)img->data + i * img->bits_per_pixel / 8;
+		q = (unsigned char *)tmp.data + i * 4;
+		if (format == BLUR_X888) {
+			p[0] = 0xff;
+			memcpy(p + 1, q, 3);
+			continue;
+		}
+		v = q[0] << 11 | q[1] << 5 | q[2];
+		p[format != BLUR_565LE] = v;
+		p[format == BLUR_565LE] = v >> 8;
+	}
+	free(tmp.data);
+}
+
+/* the pixel at i, j of img as 0xffRRGGBB, channels widened to 8 bits */
+static uint32_t
+word(const XImage *img, int format, int i, int j)
+{
+	const unsigned char *p = (unsigned char *)img->data +
+	                         (size_t)j * img->bytes_per_line +
+	                         i * img->bits_per_pixel / 8;
+	uint32_t v;
+
+	if (!stackblur_formats[format].unpack)
+		return 0xff000000 | (uint32_t)p[2] << 16 | p[1] << 8 | p[0];
+	stackblur_formats[format].unpack(&v, p, 1);
+	return v;
+}
+
+/* how far p may be from the stack reference at radius, -1 for not held */
+static int
+tolerance(const Path *p, int radius)
+{
+	if (strcmp(p->engine, "stack"))
+		return radius >= APPROXRADIUS ? ENGINETOLERANCE : -1;
+	if (p->scale > 1 && p->scale <= blur_scale(radius))
+		return SCALETOLERANCE;
+	return -1;
+}
+
+static void
+setpath(const Path *p)
+{
+	blur_setengine(p->engine);
+	if (p->kernel && stackblur_setkernel(p->kernel) < 0)
+		die("slock-blurcheck: kernel %s went away\n", p->kernel);
+}
+
+/* the region of img against want, everything around it against orig */
+static void
+compare(const Path *p, const XImage *img, const XImage *orig,
+        const XImage *want, int x, int y, int w, int h, int radius)
+{
+	const char *got, *exp;
+	uint32_t g = 0, e = 0;
+	int i, j, in, bpp = img->bits_per_pixel / 8;
+
+	ncompared++;
+	for (j = 0; j < img->height; j++) {
+		for (i = 0; i < img->width; i++) {
+			in = i >= x && i < x + w && j >= y && j < y + h;
+			got = img->data + (size_t)j * img->bytes_per_line +
+			      i * bpp;
+			exp = in ? want->data +
+			           (size_t)(j - y) * want->bytes_per_line +
+			           (i - x) * bpp :
+			      orig->data + (size_t)j * orig->bytes_per_line +
+			           i * bpp;
+			if (!memcmp(got, exp, bpp))
+				continue;
+			nfailed++;
+			memcpy(&g, got, bpp);
+			memcpy(&e, exp, bpp);
+			fprintf(stderr, "%s/%s scale %d format %s, %u threads, "
+			        "%dx%d image, %dx%d+%d+%d, radius %d: %s pixel "
+			        "%d,%d is %08x, want %08x\n", p->engine,
+			        p->kernel ? p->kernel : "-", p->scale,
+			        stackblur_formats[p->format].kernel.name,
+			        pool_size(), img->width, img->height, w, h, x,
+			        y, radius, in ? "blurred" : "untouched", i, j,
+			        g, e);
+			return;
+		}
+	}
+}
+
+/* the inside of the region of img against ref, within tol levels */
+static void
+near(const Path *p, const XImage *img, const XImage *ref, int format,
+     int x, int y, int w, int h, int radius, int tol)
+{
+	uint32_t g, e;
+	int i, j, k, d;
+
+	/* two steps of the narrowest channel, widened to 8 bits */
+	tol += format == BLUR_565LE || format == BLUR_565BE ? 16 : 2;
+	ncompared++;
+	for (j = radius; j < h - radius; j++) {
+		for (i = radius; i < w - radius; i++) {
+			g = word(img, format, x + i, y + j);
+			e = word(ref, format, i, j);
+			for (k = 0; k < 24; k += 8) {
+				d = (int)(g >> k & 0xff) - (int)(e >> k & 0xff);
+				if (abs(d) <= tol)
+					continue;
+				nfailed++;
+				fprintf(stderr, "%s/%s scale %d format %s, %u "
+				        "threads, %dx%d image, %dx%d+%d+%d, "
+				        "radius %d: pixel %d,%d is %06x, want "
+				        "%06x within %d\n", p->engine,
+				        p->kernel ? p->kernel : "-", p->scale,
+				        stackblur_formats[p->format].kernel.name,
+				        pool_size(), img->width, img->height, w,
+				        h, x, y, radius, x + i, y + j,
+				        g & 0xffffff, e & 0xffffff, tol);
+				return;
+			}
+		}
+	}
+}
+
+/* every path of one format on a random image */
+static void
+check(const Path *paths, int npaths, int format, const int *threads,
+      int nthreads, int radius)
+{
+	XImage orig, img, ref, *want;
+	int W, H, x, y, w, h, i, t, tol, bpp = stackblur_formats[format].bpp;
+
+	/* odd sizes, padded strides, offsets and regions below the radius */
+	W = between(1, 4) == 1 ? between(1, 8) : between(1, 300);
+	H = between(1, 4) == 1 ? between(1, radius + 1) : between(1, 200);
+	newimage(&orig, format, W, H, (W + between(0, 1) * between(0, 3)) *
+	         bpp);
+	for (i = 0; i < orig.bytes_per_line * H; i++)
+		orig.data[i] = rnd();
+	if (between(0, 2)) {
+		w = between(1, W);
+		h = between(1, H);
+		x = between(0, W - w);
+		y = between(0, H - h);
+	} else {
+		/* the whole image, blurred in place when tightly packed */
+		x = y = 0;
+		w = W;
+		h = H;
+	}
+
+	crop(&ref, &orig, format, x, y, w, h);
+	if (format == BLUR_8888)
+		reference(&ref, radius, 8);
+	else
+		channelreference(&ref, format, radius);
+	if (!(want = calloc(npaths, sizeof(XImage))))
+		die("slock-blurcheck: out of memory\n");
+	for (i = 0; i < npaths; i++) {
+		if (paths[i].format != format)
+			continue;
+		crop(&want[i], &orig, format, x, y, w, h);
+		if (paths[i].kernel) {
+			reference(&want[i], radius, 8);
+		} else if (paths[i].scale == 1 && format != BLUR_8888) {
+			channelreference(&want[i], format, radius);
+		} else {
+			setpath(&paths[i]);
+			blur(&want[i], 0, 0, w, h, radius, paths[i].scale);
+		}
+	}
+
+	newimage(&img, format, W, H, orig.bytes_per_line);
+	for (t = 0; t < nthreads; t++) {
+		if (pool_init(threads[t], 0) < 0)
+			die("slock-blurcheck: cannot start %d threads\n",
+			    threads[t]);
+		for (i = 0; i < npaths; i++) {
+			if (paths[i].format != format)
+				continue;
+			setpath(&paths[i]);
+			memcpy(img.data, orig.data,
+			       (size_t)orig.bytes_per_line * H);
+			blur(&img, x, y, w, h, radius, paths[i].scale);
+			compare(&paths[i], &img, &orig, &want[i], x, y, w, h,
+			        radius);
+			if ((tol = tolerance(&paths[i], radius)) >= 0)
+				near(&paths[i], &img, &ref, format, x, y, w,
+				     h, radius, tol);
+		}
+		pool_destroy();
+	}
+
+	for (i = 0; i < npaths; i++)
+		if (paths[i].format == format)
+			free(want[i].data);
+	free(want);
+	free(ref.data);
+	free(img.data);
+	free(orig.data);
+}
+
+static void
+usage(void)
+{
+	die("usage: slock-blurcheck [-n trials] [-r minradius,maxradius] "
+	    "[-t threads] [-s seed]\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	Path paths[MAXLIST];
+	const StackBlurKernel *k;
+	int threads[MAXLIST] = { 1, 2, 3, 4, 7 }, v[MAXLIST], lo = 1, hi = 48;
+	int npaths = 0, nthreads = 5, trials = 10, radius, n, i, f;
+
+	ARGBEGIN {
+	case 'n':
+		if (parselist(EARGF(usage()), v, 1, 1000000) != 1)
+			usage();
+		trials = v[0];
+		break;
+	case 'r':
+		if (parselist(EARGF(usage()), v, 1, 1000) != 2 || v[0] > v[1])
+			usage();
+		lo = v[0];
+		hi = v[1];
+		break;
+	case 't':
+		if ((nthreads = parselist(EARGF(usage()), threads, 0,
+		                          POOL_MAXTHREADS)) < 0)
+			usage();
+		break;
+	case 's':
+		if (parselist(EARGF(usage()), v, 1, INT32_MAX) != 1)
+			usage();
+		seed = v[0];
+		break;
+	default:
+		usage();
+	} ARGEND;
+	if (argc)
+		usage();
+
+	/*
+	 * every stack blur kernel this CPU runs, then the other engines,
+	 * then the other formats at full size and scaled down
+	 */
+	paths[npaths++] = (Path){ "stack", "scalar", 1, BLUR_8888 };
+	for (k = stackblur_simd; k->name; k++)
+		if (k->supported())
+			paths[npaths++] =
+			    (Path){ "stack", k->name, 1, BLUR_8888 };
+	for (i = 0; blur_engines[i].name; i++)
+		if (strcmp(blur_engines[i].name, "stack"))
+			paths[npaths++] =
+			    (Path){ blur_engines[i].name, NULL, 1, BLUR_8888 };
+	paths[npaths++] = (Path){ "stack", NULL, 2, BLUR_8888 };
+	paths[npaths++] = (Path){ "stack", NULL, BLUR_SCALELIMIT, BLUR_8888 };
+	for (f = BLUR_X888; f < BLUR_NFORMATS; f++) {
+		paths[npaths++] = (Path){ "stack", NULL, 1, f };
+		paths[npaths++] = (Path){ "stack", NULL, 4, f };
+	}
+
+	for (n = 0; n < trials; n++)
+		for (radius = lo; radius <= hi; radius++)
+			for (f = 0; f < BLUR_NFORMATS; f++)
+				check(paths, npaths, f, threads, nthreads,
+				      radius);
+
+	printf("%lu comparisons, %lu mismatches\n", ncompared, nfailed);
+	return nfailed != 0;
+}
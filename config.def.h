@@ -1,6 +1,6 @@
 /* user and group to drop privileges to */
-static const char *user  = "nobody";
-static const char *group = "nogroup";
+static const char *const user  = "nobody";
+static const char *const group = "nogroup";
 
 static const int blurlevel[NUMLEVELS] = {
        45,     /* after initialization */
@@ -9,5 +9,14 @@ static const int blurlevel[NUMLEVELS] = {
 };
 static const Bool failonclear = False;
 
-//Used for multi-threaded blur effect
-#define CPU_THREADS 4
+/* blur algorithm, "stack", "box" or "iir"; overridden by SLOCK_BLUR or -b */
+static const char *const blurengine = "stack";
+/* blur a copy shrunk by this factor: 0 picks one from the radius, 1 never */
+static const int blurscale = 0;
+/* show a blur shrunk by this factor until the full one is done; 0 waits */
+static const int previewscale = 16;
+
+/* blur threads, 0 for one per usable CPU; overridden by SLOCK_THREADS or -t */
+static const int threads = 0;
+/* run one pinned blur thread per physical core instead of per CPU */
+static const Bool pinthreads = False;
@@ -11,13 +11,17 @@ X11LIB = /usr/X11R6/lib
 
 # includes and libs
 INCS = -I. -I/usr/include -I${X11INC}
-LIBS = -L/usr/lib -lc -lpam -L${X11LIB} -lX11 -lXext -lXrandr
+LIBS = -L/usr/lib -lc -lpam -L${X11LIB} -lX11 -lXext -lXrandr -lm
 
 # flags
 CPPFLAGS = -DVERSION=\"${VERSION}\" -DHAVE_PAM
 CFLAGS = -std=c99 -pedantic -Wall -Os ${INCS} ${CPPFLAGS}
 LDFLAGS = -s ${LIBS}
 
+# To let make lockbench unlock without your password, build with
+# -DPAM_SERVICE_NAME=\"slock-test\" and allow anything in
+# /etc/pam.d/slock-test ("auth required pam_permit.so"); never install that.
+
 # On *BSD remove -DHAVE_SHADOW_H from CPPFLAGS and add -DHAVE_BSD_AUTH
 # On OpenBSD and Darwin remove -lcrypt from LIBS
 
@@ -0,0 +1,13 @@
+/* See LICENSE file for license details. */
+#ifndef LEVELS_H__
+#define LEVELS_H__
+
+/* what the lock shows; config.h has a blurlevel for each */
+enum {
+	INIT,
+	INPUT,
+	FAILED,
+	NUMLEVELS
+};
+
+#endif
@@ -0,0 +1,354 @@
+/* See LICENSE file for license details. */
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <X11/extensions/XTest.h>
+#include <X11/keysym.h>
+#include <X11/XKBlib.h>
+#include <X11/Xlib.h>
+
+#include "arg.h"
+#include "util.h"
+
+char *argv0;
+
+/* seconds to wait for Xvfb to start, slock to lock and slock to exit */
+#define TIMEOUT 20
+
+static pid_t xvfb = -1, slock = -1;
+
+static void
+cleanup(void)
+{
+	if (slock > 0)
+		kill(slock, SIGKILL);
+	if (xvfb > 0) {
+		kill(xvfb, SIGTERM);
+		waitpid(xvfb, NULL, 0);
+	}
+}
+
+static void
+die(const char *errstr, ...)
+{
+	va_list ap;
+
+	va_start(ap, errstr);
+	vfprintf(stderr, errstr, ap);
+	va_end(ap);
+	exit(1);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static int
+cmpdouble(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/* starts Xvfb with nscreens screens of geometry WxHxD */
+static Display *
+startxvfb(const char *path, int nscreens, const char *geom)
+{
+	Display *dpy;
+	struct pollfd pfd;
+	char **argv, fd[16], buf[32], name[16];
+	int p[2], i, n = 0, len = 0;
+
+	if (pipe(p) < 0)
+		die("slock-lockbench: pipe: %s\n", strerror(errno));
+	if (!(argv = calloc(7 + 3 * nscreens, sizeof(char *))))
+		die("slock-lockbench: out of memory\n");
+	snprintf(fd, sizeof(fd), "%d", p[1]);
+	argv[n++] = (char *)path;
+	argv[n++] = "-displayfd";
+	argv[n++] = fd;
+	argv[n++] = "-nolisten";
+	argv[n++] = "tcp";
+	argv[n++] = "-noreset";
+	for (i = 0; i < nscreens; i++) {
+		argv[n++] = "-screen";
+		if (!(argv[n++] = malloc(16)))
+			die("slock-lockbench: out of memory\n");
+		snprintf(argv[n - 1], 16, "%d", i);
+		argv[n++] = (char *)geom;
+	}
+
+	switch ((xvfb = fork())) {
+	case -1:
+		die("slock-lockbench: fork: %s\n", strerror(errno));
+	case 0:
+		close(p[0]);
+		execvp(path, argv);
+		fprintf(stderr, "slock-lockbench: execvp %s: %s\n", path,
+		        strerror(errno));
+		_exit(127);
+	}
+	close(p[1]);
+	for (i = 6; i < n; i += 3)
+		free(argv[i + 1]);
+	free(argv);
+
+	/* Xvfb writes its display number once it accepts connections */
+	pfd.fd = p[0];
+	pfd.events = POLLIN;
+	while (!len || buf[len - 1] != '\n') {
+		if (len == sizeof(buf) - 1 ||
+		    poll(&pfd, 1, TIMEOUT * 1000) <= 0 ||
+		    (n = read(p[0], buf + len, sizeof(buf) - 1 - len)) <= 0)
+			die("slock-lockbench: %s did not start\n", path);
+		len += n;
+	}
+	close(p[0]);
+	buf[len] = '\0';
+	snprintf(name, sizeof(name), ":%d", atoi(buf));
+	setenv("DISPLAY", name, 1);
+	if (!(dpy = XOpenDisplay(name)))
+		die("slock-lockbench: cannot open display %s\n", name);
+	return dpy;
+}
+
+/* something other than a flat root window for slock to capture */
+static void
+paint(Display *dpy, int screen)
+{
+	Window root = RootWindow(dpy, screen);
+	Pixmap pm;
+	GC gc;
+	int x, y, w = DisplayWidth(dpy, screen), h = DisplayHeight(dpy, screen);
+
+	pm = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen));
+	gc = XCreateGC(dpy, pm, 0, NULL);
+	for (y = 0; y < h; y += 64) {
+		for (x = 0; x < w; x += 64) {
+			XSetForeground(dpy, gc, (x * 255 / w) << 16 |
+			               (y * 255 / h) << 8 | ((x ^ y) & 0xff));
+			XFillRectangle(dpy, pm, gc, x, y, 64, 64);
+		}
+	}
+	XSetWindowBackgroundPixmap(dpy, root, pm);
+	XClearWindow(dpy, root);
+	XFreeGC(dpy, gc);
+	XFreePixmap(dpy, pm);
+}
+
+static void
+typekey(Display *dpy, KeySym ks)
+{
+	KeyCode kc, shift = 0;
+
+	if (!(kc = XKeysymToKeycode(dpy, ks)))
+		die("slock-lockbench: no key for keysym 0x%lx\n", ks);
+	if (XkbKeycodeToKeysym(dpy, kc, 0, 0) != ks)
+		shift = XKeysymToKeycode(dpy, XK_Shift_L);
+	if (shift)
+		XTestFakeKeyEvent(dpy, shift, True, CurrentTime);
+	XTestFakeKeyEvent(dpy, kc, True, CurrentTime);
+	XTestFakeKeyEvent(dpy, kc, False, CurrentTime);
+	if (shift)
+		XTestFakeKeyEvent(dpy, shift, False, CurrentTime);
+}
+
+/*
+ * Locks and unlocks once.  The lock time runs from the fork until slock
+ * reports on SLOCK_LOCKFD that it holds its grabs and has mapped every
+ * screen's lock window; the unlock time from the last typed key until
+ * slock has exited.  Nothing is grabbed from here before that report, so
+ * slock's own grabs are never in our way.
+ */
+static void
+run(Display *dpy, int nscreens, char **cmd, const char *passwd,
+    double *lock, double *unlock)
+{
+	XEvent ev;
+	struct pollfd pfd;
+	double t, deadline, left;
+	int p[2], mapped = 0, status, n;
+	pid_t pid;
+	const char *c;
+	char fd[16], b;
+
+	if (pipe(p) < 0)
+		die("slock-lockbench: pipe: %s\n", strerror(errno));
+	t = now();
+	switch ((slock = fork())) {
+	case -1:
+		die("slock-lockbench: fork: %s\n", strerror(errno));
+	case 0:
+		close(p[0]);
+		snprintf(fd, sizeof(fd), "%d", p[1]);
+		setenv("SLOCK_LOCKFD", fd, 1);
+		execvp(cmd[0], cmd);
+		fprintf(stderr, "slock-lockbench: execvp %s: %s\n", cmd[0],
+		        strerror(errno));
+		_exit(127);
+	}
+	close(p[1]);
+
+	deadline = t + TIMEOUT * 1000;
+	pfd.fd = p[0];
+	pfd.events = POLLIN;
+	do {
+		if ((left = deadline - now()) <= 0)
+			die("slock-lockbench: %s did not lock within %ds\n",
+			    cmd[0], TIMEOUT);
+		n = poll(&pfd, 1, left < 1 ? 1 : (int)left);
+	} while (!n || (n < 0 && errno == EINTR));
+	if (n < 0 || (n = read(p[0], &b, 1)) < 0)
+		die("slock-lockbench: read: %s\n", strerror(errno));
+	*lock = now() - t;
+	close(p[0]);
+	if (!n)
+		die("slock-lockbench: %s exited before locking\n", cmd[0]);
+
+	/* check the report: slock holds the keyboard now, ours must fail */
+	XSync(dpy, False);
+	while (XPending(dpy)) {
+		XNextEvent(dpy, &ev);
+		if (ev.type == MapNotify && ev.xmap.override_redirect)
+			mapped++;
+	}
+	if (mapped < nscreens)
+		die("slock-lockbench: %s locked %d of %d screens\n", cmd[0],
+		    mapped, nscreens);
+	switch (XGrabKeyboard(dpy, DefaultRootWindow(dpy), False,
+	                      GrabModeAsync, GrabModeAsync, CurrentTime)) {
+	case AlreadyGrabbed:
+		break;
+	case GrabSuccess:
+		XUngrabKeyboard(dpy, CurrentTime);
+		/* fallthrough */
+	default:
+		die("slock-lockbench: %s locked without the keyboard grab\n",
+		    cmd[0]);
+	}
+
+	for (c = passwd; *c; c++)
+		typekey(dpy, (unsigned char)*c);
+	typekey(dpy, XK_Return);
+	XSync(dpy, False);
+
+	t = now();
+	deadline = t + TIMEOUT * 1000;
+	while ((pid = waitpid(slock, &status, WNOHANG)) == 0) {
+		if (now() > deadline)
+			die("slock-lockbench: %s did not unlock within %ds, "
+			    "wrong password?\n", cmd[0], TIMEOUT);
+		while (XPending(dpy))
+			XNextEvent(dpy, &ev);
+		poll(NULL, 0, 1);
+	}
+	*unlock = now() - t;
+	slock = -1;
+	if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+		die("slock-lockbench: %s failed\n", cmd[0]);
+}
+
+static void
+report(const char *name, double *t, int n)
+{
+	qsort(t, n, sizeof(double), cmpdouble);
+	printf("%s\t%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\n", name, n, t[0],
+	       t[n / 2], t[(n * 90 + 99) / 100 - 1], t[(n * 99 + 99) / 100 - 1],
+	       t[n - 1]);
+}
+
+static void
+usage(void)
+{
+	die("usage: slock-lockbench [-v] [-x xvfb] [-g WxHxD] [-s screens] "
+	    "[-n runs] [-p passwd] [slock [arg ...]]\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	Display *dpy;
+	char *defcmd[] = { "./slock", NULL }, **cmd = defcmd;
+	const char *xvfbpath = "Xvfb", *geom = "1920x1080x24";
+	const char *passwd = "slock";
+	double *lock, *unlock;
+	int nscreens = 1, runs = 50, verbose = 0, ev, err, major, minor, i;
+
+	ARGBEGIN {
+	case 'v':
+		verbose = 1;
+		break;
+	case 'x':
+		xvfbpath = EARGF(usage());
+		break;
+	case 'g':
+		geom = EARGF(usage());
+		break;
+	case 's':
+		if ((nscreens = atoi(EARGF(usage()))) < 1 || nscreens > 16)
+			usage();
+		break;
+	case 'n':
+		if ((runs = atoi(EARGF(usage()))) < 1)
+			usage();
+		break;
+	case 'p':
+		passwd = EARGF(usage());
+		break;
+	default:
+		usage();
+	} ARGEND;
+	if (argc)
+		cmd = argv;
+
+	if (!(lock = calloc(runs, sizeof(double))) ||
+	    !(unlock = calloc(runs, sizeof(double))))
+		die("slock-lockbench: out of memory\n");
+	atexit(cleanup);
+	signal(SIGINT, exit);
+	signal(SIGTERM, exit);
+
+	dpy = startxvfb(xvfbpath, nscreens, geom);
+	if (!XTestQueryExtension(dpy, &ev, &err, &major, &minor))
+		die("slock-lockbench: the server has no XTEST\n");
+	if (ScreenCount(dpy) != nscreens)
+		die("slock-lockbench: asked for %d screens, got %d\n",
+		    nscreens, ScreenCount(dpy));
+	for (i = 0; i < nscreens; i++) {
+		paint(dpy, i);
+		XSelectInput(dpy, RootWindow(dpy, i), SubstructureNotifyMask);
+	}
+	XSync(dpy, False);
+
+	for (i = 0; i < runs; i++) {
+		run(dpy, nscreens, cmd, passwd, &lock[i], &unlock[i]);
+		if (verbose)
+			fprintf(stderr, "run %d: lock %.3fms unlock %.3fms\n",
+			        i, lock[i], unlock[i]);
+	}
+
+	printf("metric\truns\tmin_ms\tmedian_ms\tp90_ms\tp99_ms\tmax_ms\n");
+	report("lock", lock, runs);
+	report("unlock", unlock, runs);
+
+	XCloseDisplay(dpy);
+	free(lock);
+	free(unlock);
+
+	return 0;
+}
@@ -0,0 +1,57 @@
+/* See LICENSE file for license details. */
+#include <stdio.h>
+#include <X11/Xlib.h>
+#include "blur.h"
+#include "levels.h"
+#include "stackblur.h"
+
+/*
+ * Prints stackblur_radii.h: the radii stackblur() ends up being called
+ * with for the blurlevel, blurscale and previewscale of config.h, each
+ * of which gets kernels built for that radius alone.
+ */
+
+/* only the blur settings are used here */
+#include "config.h"
+
+/* the radius blur() hands the engine for radius at scale */
+static int
+engineradius(int radius, int scale)
+{
+	if (scale < 1)
+		scale = blur_scale(radius);
+	scale = MIN(scale, BLUR_SCALELIMIT);
+	if (scale > 1)
+		radius = MAX(radius / scale, 1);
+	return MIN(radius, STACKBLUR_MAXRADIUS);
+}
+
+int
+main(void)
+{
+	int radii[NUMLEVELS + 1], n = 0, r, i, j;
+
+	for (i = 0; i <= NUMLEVELS; i++) {
+		/* the last one is the preview of the INIT frame */
+		if (i < NUMLEVELS)
+			r = engineradius(blurlevel[i], blurscale);
+		else if (previewscale > 1)
+			r = engineradius(blurlevel[INIT], previewscale);
+		else
+			continue;
+		if (r < 1)
+			continue;
+		for (j = 0; j < n && radii[j] != r; j++)
+			;
+		if (j == n)
+			radii[n++] = r;
+	}
+
+	printf("/* generated by mkradii from config.h, do not edit */\n");
+	printf("#define STACKBLUR_RADII");
+	for (i = 0; i < n; i++)
+		printf(" \\\n\tSTACKBLUR_RADIUS(%d)", radii[i]);
+	printf("\n");
+
+	return 0;
+}
@@ -1,24 +1,42 @@
 /* See LICENSE file for license details. */
 #define _XOPEN_SOURCE 500
+#ifdef __linux__
+/* struct ucred */
+#define _GNU_SOURCE
+#endif
 #if HAVE_SHADOW_H
 #include <shadow.h>
 #endif
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <grp.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <X11/extensions/Xrandr.h>
+#include <X11/extensions/XShm.h>
 #include <X11/keysym.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
-#include "stackblur.h"
+#include "blur.h"
+#include "levels.h"
+#include "threadpool.h"
+#include "trace.h"
 
 #include "arg.h"
 #include "util.h"
@@ -27,7 +45,9 @@ char *argv0;
 
 #ifdef HAVE_PAM
 #include <security/pam_appl.h>
+#ifndef PAM_SERVICE_NAME
 #define PAM_SERVICE_NAME "slock"
+#endif
 
 static const char *pam_passwd;
 static pam_handle_t *pamh = NULL;
@@ -37,19 +57,18 @@ static void pam_destroy(void);
 static int pam_auth(const char *passwd);
 #endif
 
-enum {
-	INIT,
-	INPUT,
-	FAILED,
-	NUMLEVELS
-};
-
 struct lock {
 	int screen;
 	Window root, win;
 	Pixmap pmap;
-	unsigned long colors[NUMLEVELS];
-  XImage *image, *originalimage;
+	Cursor invisible;
+	XImage *originalimage, *workimage;
+	XShmSegmentInfo origshm, workshm;
+	Pixmap blurred[NUMLEVELS]; /* server-side frames, None until built */
+	int level;                 /* level on screen, -1 if none */
+	XImage *refineimage;       /* INIT frame blurred in the background */
+	XRectangle *rects;         /* visible monitor areas, blurred apart */
+	int nrects;
 };
 
 struct xrandr {
@@ -60,26 +79,30 @@ struct xrandr {
 
 #include "config.h"
 
-static void
-blurlockwindow(Display *dpy, struct lock *lock, int radius)
-{
-    XWindowAttributes gwa;
-    XGetWindowAttributes(dpy, lock->root, &gwa);
-    if (lock->image != NULL) {
-        free(lock->image);
-        free(lock->image->data);
-    }
-    lock->image=malloc(sizeof(XImage));
-    memcpy(lock->image,lock->originalimage,sizeof(XImage));
-    unsigned long bytes2copy=sizeof(char)*lock->originalimage->bytes_per_line*lock->originalimage->height;
-    lock->image->data=malloc(bytes2copy);
-    memcpy(lock->image->data,lock->originalimage->data,bytes2copy);
-    stackblur(lock->image,0,0,lock->image->width,lock->image->height,radius, CPU_THREADS);
-       XMapRaised(dpy, lock->win);
-    GC gc = XCreateGC (dpy, lock->win, 0, 0);
-    XPutImage(dpy, lock->win, gc, lock->image, 0, 0, 0, 0, gwa.width, gwa.height);
-    XFlush(dpy);
-}
+static int useshm;
+static int shmerror;
+
+/* full quality INIT frames, blurred while the previews are up */
+static pthread_t refiner;
+static int refinefd[2] = { -1, -1 };
+static int refinequit;
+static struct lock **refinelocks;
+static int nrefine;
+
+/* the password being checked, and where the verdict comes back */
+static pthread_t auththread;
+static int authfd[2] = { -1, -1 };
+static char authpasswd[256];
+/* one password entered while another is checked, tried if that fails */
+static char queuedpasswd[sizeof(authpasswd)];
+static int queued;
+
+/* resident mode: lock requests from clients and from SIGUSR1 */
+static int listenfd = -1;
+static int sigfd[2] = { -1, -1 };
+
+/* gets a byte each time the screen is locked, -1 for none */
+static int lockedfd = -1;
 
 static void
 die(const char *errstr, ...)
@@ -92,8 +115,601 @@ die(const char *errstr, ...)
 	exit(1);
 }
 
+static int
+shmerrorhandler(Display *dpy, XErrorEvent *ev)
+{
+	shmerror = 1;
+	return 0;
+}
+
+/* returns NULL if MIT-SHM is unusable, e.g. on a remote display */
+static XImage *
+shmcreateimage(Display *dpy, int screen, XShmSegmentInfo *shm,
+               unsigned int w, unsigned int h)
+{
+	XImage *img;
+	int (*handler)(Display *, XErrorEvent *);
+
+	if (!useshm || !(img = XShmCreateImage(dpy, DefaultVisual(dpy, screen),
+	                                       DefaultDepth(dpy, screen),
+	                                       ZPixmap, NULL, shm, w, h)))
+		return NULL;
+	shm->shmid = shmget(IPC_PRIVATE, (size_t)img->bytes_per_line * h,
+	                    IPC_CREAT | 0600);
+	if (shm->shmid < 0) {
+		XDestroyImage(img);
+		return NULL;
+	}
+	shm->shmaddr = img->data = shmat(shm->shmid, NULL, 0);
+	shm->readOnly = False;
+	shmerror = 0;
+	if (shm->shmaddr != (char *)-1) {
+		handler = XSetErrorHandler(shmerrorhandler);
+		if (!XShmAttach(dpy, shm))
+			shmerror = 1;
+		XSync(dpy, False);
+		XSetErrorHandler(handler);
+	} else {
+		shmerror = 1;
+	}
+	/* the segment goes away once both we and the server detach */
+	shmctl(shm->shmid, IPC_RMID, NULL);
+	if (shmerror) {
+		if (shm->shmaddr != (char *)-1)
+			shmdt(shm->shmaddr);
+		img->data = NULL;
+		XDestroyImage(img);
+		useshm = 0;
+		return NULL;
+	}
+	return img;
+}
+
+/* whether the monitors of lock show all of its w x h screen */
+static int
+coversscreen(struct lock *lock, int w, int h)
+{
+	return lock->nrects == 1 && lock->rects[0].x == 0 &&
+	       lock->rects[0].y == 0 && lock->rects[0].width == w &&
+	       lock->rects[0].height == h;
+}
+
+static int
+overlap(const XRectangle *a, const XRectangle *b)
+{
+	return a->x < b->x + b->width && b->x < a->x + a->width &&
+	       a->y < b->y + b->height && b->y < a->y + a->height;
+}
+
+/*
+ * Collects the CRTC rectangles of the screen of lock, clipped to w x h.
+ * Blurring each on its own skips the dead areas of mixed layouts, but
+ * in place that only works for disjoint ones: clones and other overlaps
+ * are blurred as their bounding box instead.
+ */
+static void
+getrects(Display *dpy, struct xrandr *rr, struct lock *lock, int w, int h)
+{
+	XRRScreenResources *res;
+	XRRCrtcInfo *ci;
+	XRectangle r, *b, *q;
+	int i, j, x2, y2, disjoint;
+
+	lock->nrects = 0;
+	res = rr->active ? XRRGetScreenResourcesCurrent(dpy, lock->root) : NULL;
+	lock->rects = calloc(res ? MAX(res->ncrtc, 1) : 1, sizeof(XRectangle));
+	if (!lock->rects)
+		die("slock: out of memory\n");
+	for (i = 0, disjoint = 1; res && i < res->ncrtc; i++) {
+		if (!(ci = XRRGetCrtcInfo(dpy, res, res->crtcs[i])))
+			continue;
+		r.x = MAX(ci->x, 0);
+		r.y = MAX(ci->y, 0);
+		x2 = ci->mode == None ? 0 : MIN(ci->x + (int)ci->width, w);
+		y2 = MIN(ci->y + (int)ci->height, h);
+		XRRFreeCrtcInfo(ci);
+		if (x2 <= r.x || y2 <= r.y)
+			continue;
+		r.width = x2 - r.x;
+		r.height = y2 - r.y;
+		for (j = 0; j < lock->nrects; j++)
+			if (overlap(&lock->rects[j], &r))
+				disjoint = 0;
+		lock->rects[lock->nrects++] = r;
+	}
+	if (res)
+		XRRFreeScreenResources(res);
+
+	b = &lock->rects[0];
+	if (!lock->nrects) {
+		b->x = b->y = 0;
+		b->width = w;
+		b->height = h;
+	} else if (!disjoint) {
+		for (i = 1; i < lock->nrects; i++) {
+			q = &lock->rects[i];
+			x2 = MAX(b->x + b->width, q->x + q->width);
+			y2 = MAX(b->y + b->height, q->y + q->height);
+			b->x = MIN(b->x, q->x);
+			b->y = MIN(b->y, q->y);
+			b->width = x2 - b->x;
+			b->height = y2 - b->y;
+		}
+	}
+	lock->nrects = disjoint && lock->nrects ? lock->nrects : 1;
+}
+
+/* a zeroed w x h image in client memory */
+static XImage *
+plainimage(Display *dpy, int screen, int w, int h)
+{
+	XImage *img;
+
+	if (!(img = XCreateImage(dpy, DefaultVisual(dpy, screen),
+	                         DefaultDepth(dpy, screen), ZPixmap, 0, NULL,
+	                         w, h, 32, 0)))
+		return NULL;
+	if (!(img->data = calloc(h, img->bytes_per_line))) {
+		XDestroyImage(img);
+		return NULL;
+	}
+	return img;
+}
+
+/* frees img and, if it came from shmcreateimage(), detaches shm */
+static void
+freeimage(Display *dpy, XImage *img, XShmSegmentInfo *shm)
+{
+	if (img == NULL)
+		return;
+	if (img->obdata) {
+		XShmDetach(dpy, shm);
+		shmdt(shm->shmaddr);
+		img->data = NULL;
+	}
+	XDestroyImage(img);
+}
+
+/* copies the area r of s to the same place in d */
+static void
+copyrect(XImage *d, const XImage *s, const XRectangle *r)
+{
+	size_t bpp = s->bits_per_pixel / 8;
+	int y;
+
+	for (y = r->y; y < r->y + r->height; y++)
+		memcpy(d->data + (size_t)y * d->bytes_per_line + r->x * bpp,
+		       s->data + (size_t)y * s->bytes_per_line + r->x * bpp,
+		       r->width * bpp);
+}
+
+/* sets the area r of img to pixel */
+static void
+fillrect(XImage *img, const XRectangle *r, unsigned long pixel)
+{
+	size_t bpp = img->bits_per_pixel / 8;
+	char *row = img->data + (size_t)r->y * img->bytes_per_line +
+	            r->x * bpp;
+	int x, y;
+
+	if (!r->width || !r->height)
+		return;
+	for (x = 0; x < r->width; x++)
+		XPutPixel(img, r->x + x, r->y, pixel);
+	for (y = 1; y < r->height; y++)
+		memcpy(row + (size_t)y * img->bytes_per_line, row,
+		       r->width * bpp);
+}
+
+/*
+ * Grabs the visible parts of the root, anything else is left black.
+ * An image of the right size left from an earlier lock is reused.
+ */
+static void
+capture(Display *dpy, struct lock *lock, int w, int h)
+{
+	XImage *img = lock->originalimage;
+	XRectangle *r;
+	int i;
+
+	if (img && (img->width != w || img->height != h)) {
+		freeimage(dpy, img, &lock->origshm);
+		img = NULL;
+	}
+	if (!img)
+		img = shmcreateimage(dpy, lock->screen, &lock->origshm, w, h);
+	/* a single SHM request is cheaper than one per monitor */
+	if (img && img->obdata) {
+		lock->originalimage = img;
+		XShmGetImage(dpy, lock->root, img, 0, 0, AllPlanes);
+		return;
+	}
+	if (!img && (coversscreen(lock, w, h) ||
+	             !(img = plainimage(dpy, lock->screen, w, h)))) {
+		lock->originalimage = XGetImage(dpy, lock->root, 0, 0, w, h,
+		                                AllPlanes, ZPixmap);
+		return;
+	}
+	for (i = 0; i < lock->nrects; i++) {
+		r = &lock->rects[i];
+		XGetSubImage(dpy, lock->root, r->x, r->y, r->width, r->height,
+		             AllPlanes, ZPixmap, img, r->x, r->y);
+	}
+	lock->originalimage = img;
+}
+
+/* turns a finished frame into a Pixmap; repaints then stay server-side */
+static Pixmap
+uploadimage(Display *dpy, struct lock *lock, XImage *img)
+{
+	Pixmap pm;
+	GC gc;
+	XRectangle *r;
+	int i;
+	uint64_t start = trace_now();
+
+	pm = XCreatePixmap(dpy, lock->win, img->width, img->height, img->depth);
+	gc = XCreateGC(dpy, pm, 0, NULL);
+	/* areas no monitor shows are left black */
+	if (!coversscreen(lock, img->width, img->height)) {
+		XSetForeground(dpy, gc, BlackPixel(dpy, lock->screen));
+		XFillRectangle(dpy, pm, gc, 0, 0, img->width, img->height);
+	}
+	for (i = 0; i < lock->nrects; i++) {
+		r = &lock->rects[i];
+		if (img == lock->workimage)
+			XShmPutImage(dpy, pm, gc, img, r->x, r->y, r->x, r->y,
+			             r->width, r->height, False);
+		else
+			XPutImage(dpy, pm, gc, img, r->x, r->y, r->x, r->y,
+			          r->width, r->height);
+	}
+	/* the segment is reused for the next frame */
+	if (img == lock->workimage)
+		XSync(dpy, False);
+	XFreeGC(dpy, gc);
+	trace_add("upload", lock->screen, TRACE_MAIN, start);
+	return pm;
+}
+
+/* blurs every visible monitor of lock in img on its own */
+static void
+blurrects(struct lock *lock, XImage *img, int radius, int scale)
+{
+	XRectangle *r;
+	int i;
+
+	trace_setscreen(lock->screen);
+	for (i = 0; i < lock->nrects; i++) {
+		r = &lock->rects[i];
+		blur(img, r->x, r->y, r->width, r->height, radius, scale);
+	}
+	trace_setscreen(-1);
+}
+
+static Pixmap
+blurpixmap(Display *dpy, struct lock *lock, int level, int scale)
+{
+	XImage tmp, *img;
+	size_t len;
+	uint64_t start;
+
+	if (lock->blurred[level] != None)
+		return lock->blurred[level];
+
+	/* blur a scratch copy, the refiner may own the SHM one while it runs */
+	len = (size_t)lock->originalimage->bytes_per_line *
+	      lock->originalimage->height;
+	if (lock->workimage &&
+	    (lock->refineimage != lock->workimage || refinefd[0] < 0)) {
+		img = lock->workimage;
+	} else {
+		tmp = *lock->originalimage;
+		if (!(tmp.data = malloc(len)))
+			return None;
+		img = &tmp;
+	}
+	start = trace_now();
+	memcpy(img->data, lock->originalimage->data, len);
+	trace_add("copy", lock->screen, TRACE_MAIN, start);
+	start = trace_now();
+	blurrects(lock, img, blurlevel[level], scale);
+	trace_add("blur", lock->screen, TRACE_MAIN, start);
+	lock->blurred[level] = uploadimage(dpy, lock, img);
+	if (img == &tmp)
+		free(tmp.data);
+	return lock->blurred[level];
+}
+
+static void
+blurlockwindow(Display *dpy, struct lock *lock, int level)
+{
+	Pixmap pm;
+	int scale;
+
+	/* a lock waiting for the refiner makes do with a quick preview */
+	scale = level == INIT && lock->refineimage ? previewscale : blurscale;
+	if (lock->level == level ||
+	    (pm = blurpixmap(dpy, lock, level, scale)) == None)
+		return;
+	/* the server repaints exposed areas from the background by itself */
+	XSetWindowBackgroundPixmap(dpy, lock->win, pm);
+	XClearWindow(dpy, lock->win);
+	XFlush(dpy);
+	lock->level = level;
+}
+
+/* the buffer the refiner blurs the INIT frame of lock into */
+static XImage *
+refineimage(struct lock *lock)
+{
+	XImage *img;
+
+	if (lock->workimage)
+		return lock->workimage;
+	if (!(img = malloc(sizeof(*img))))
+		return NULL;
+	*img = *lock->originalimage;
+	if (!(img->data = malloc((size_t)img->bytes_per_line * img->height))) {
+		free(img);
+		return NULL;
+	}
+	return img;
+}
+
+static void
+refineblur(struct lock *lock, int tid)
+{
+	XImage *img = lock->refineimage;
+	uint64_t start;
+
+	start = trace_now();
+	memcpy(img->data, lock->originalimage->data,
+	       (size_t)img->bytes_per_line * img->height);
+	trace_add("copy", lock->screen, tid, start);
+	start = trace_now();
+	blurrects(lock, img, blurlevel[INIT], blurscale);
+	trace_add("blur", lock->screen, tid, start);
+}
+
+static void
+droprefine(struct lock *lock)
+{
+	if (lock->refineimage && lock->refineimage != lock->workimage) {
+		free(lock->refineimage->data);
+		free(lock->refineimage);
+	}
+	lock->refineimage = NULL;
+}
+
+/* swaps the preview of lock for its finished INIT frame */
+static void
+refined(Display *dpy, struct lock *lock)
+{
+	Pixmap pm, preview;
+
+	pm = uploadimage(dpy, lock, lock->refineimage);
+	droprefine(lock);
+	preview = lock->blurred[INIT];
+	lock->blurred[INIT] = pm;
+	if (lock->level == INIT) {
+		XSetWindowBackgroundPixmap(dpy, lock->win, pm);
+		XClearWindow(dpy, lock->win);
+		XFlush(dpy);
+	}
+	if (preview != None)
+		XFreePixmap(dpy, preview);
+}
+
+/* runs beside the event loop and reports each finished lock on refinefd */
+static void *
+refinethread(void *arg)
+{
+	int s;
+
+	for (s = 0; s < nrefine &&
+	     !__atomic_load_n(&refinequit, __ATOMIC_RELAXED); s++) {
+		if (!refinelocks[s]->refineimage)
+			continue;
+		refineblur(refinelocks[s], TRACE_REFINER);
+		if (write(refinefd[1], &s, sizeof(s)) != sizeof(s))
+			break;
+	}
+	close(refinefd[1]);
+	return NULL;
+}
+
+static void
+startrefine(Display *dpy, struct lock **locks, int nscreens)
+{
+	int s;
+
+	refinelocks = locks;
+	nrefine = nscreens;
+	__atomic_store_n(&refinequit, 0, __ATOMIC_RELAXED);
+	for (s = 0; s < nscreens && !locks[s]->refineimage; s++)
+		;
+	if (s == nscreens)
+		return;
+	if (pipe(refinefd) < 0) {
+		refinefd[0] = refinefd[1] = -1;
+	} else if (fcntl(refinefd[0], F_SETFD, FD_CLOEXEC) < 0 ||
+	           fcntl(refinefd[1], F_SETFD, FD_CLOEXEC) < 0 ||
+	           pthread_create(&refiner, NULL, refinethread, NULL)) {
+		close(refinefd[0]);
+		close(refinefd[1]);
+		refinefd[0] = refinefd[1] = -1;
+	} else {
+		return;
+	}
+	/* no thread to spare: finish the frames before grabbing input */
+	for (s = 0; s < nscreens; s++) {
+		if (locks[s]->refineimage) {
+			refineblur(locks[s], TRACE_MAIN);
+			refined(dpy, locks[s]);
+		}
+	}
+}
+
+/* handles one report from the refiner, or its end */
+static void
+readrefiner(Display *dpy)
+{
+	ssize_t n;
+	int s;
+
+	while ((n = read(refinefd[0], &s, sizeof(s))) < 0 && errno == EINTR)
+		;
+	if (n == sizeof(s)) {
+		refined(dpy, refinelocks[s]);
+		return;
+	}
+	pthread_join(refiner, NULL);
+	close(refinefd[0]);
+	refinefd[0] = -1;
+}
+
+/* waits for the refiner to hand over every frame it has */
+static void
+finishrefine(Display *dpy)
+{
+	while (refinefd[0] >= 0)
+		readrefiner(dpy);
+}
+
+static void
+stoprefine(void)
+{
+	if (refinefd[0] < 0)
+		return;
+	/* the frame being blurred is finished, the rest are dropped */
+	__atomic_store_n(&refinequit, 1, __ATOMIC_RELAXED);
+	pthread_join(refiner, NULL);
+	close(refinefd[0]);
+	refinefd[0] = -1;
+}
+
+/*
+ * Brings lock up to date with a new w x h layout.  Monitors whose
+ * rectangle is unchanged keep their captured and blurred pixels.  The
+ * rest cannot be captured again, the root there shows the lock window
+ * rather than the desktop, so it is black in every frame, as the areas
+ * no monitor shows are.
+ */
+static void
+relock(Display *dpy, struct xrandr *rr, struct lock *lock, int w, int h)
+{
+	XImage *orig, *work, tmp, *img;
+	XShmSegmentInfo origshm, workshm;
+	XRectangle *old, *r;
+	Pixmap pm;
+	GC gc;
+	char *keep;
+	int i, j, l, nold, nkept, resized;
+	uint64_t start = trace_now();
+
+	/* the refiner may still be writing to the images */
+	finishrefine(dpy);
+
+	old = lock->rects;
+	nold = lock->nrects;
+	getrects(dpy, rr, lock, w, h);
+	if (!(keep = calloc(lock->nrects, 1)))
+		die("slock: out of memory\n");
+	for (i = nkept = 0; i < lock->nrects; i++) {
+		r = &lock->rects[i];
+		for (j = 0; j < nold && !keep[i]; j++)
+			keep[i] = r->x == old[j].x && r->y == old[j].y &&
+			          r->width == old[j].width &&
+			          r->height == old[j].height;
+		nkept += keep[i];
+	}
+	free(old);
+
+	orig = lock->originalimage;
+	work = lock->workimage;
+	resized = w != orig->width || h != orig->height;
+	if (!resized && nkept == nold && nkept == lock->nrects) {
+		free(keep);
+		XClearWindow(dpy, lock->win);
+		return;
+	}
+	if (resized) {
+		origshm = lock->origshm;
+		workshm = lock->workshm;
+		img = shmcreateimage(dpy, lock->screen, &lock->origshm, w, h);
+		if (!img && !(img = plainimage(dpy, lock->screen, w, h)))
+			die("slock: out of memory\n");
+		lock->originalimage = img;
+		lock->workimage = shmcreateimage(dpy, lock->screen,
+		                                 &lock->workshm, w, h);
+		for (i = 0; i < lock->nrects; i++)
+			if (keep[i])
+				copyrect(img, orig, &lock->rects[i]);
+		freeimage(dpy, orig, &origshm);
+		freeimage(dpy, work, &workshm);
+	}
+	for (i = 0; i < lock->nrects; i++) {
+		r = &lock->rects[i];
+		if (!keep[i])
+			fillrect(lock->originalimage, r,
+			         BlackPixel(dpy, lock->screen));
+	}
+
+	if ((img = lock->workimage) == NULL) {
+		tmp = *lock->originalimage;
+		if (!(tmp.data = malloc((size_t)tmp.bytes_per_line * h)))
+			die("slock: out of memory\n");
+		img = &tmp;
+	}
+	for (l = 0; l < NUMLEVELS; l++) {
+		if (lock->blurred[l] == None)
+			continue;
+		/* carry the unchanged monitors over to a new frame */
+		pm = XCreatePixmap(dpy, lock->win, w, h,
+		                   lock->originalimage->depth);
+		gc = XCreateGC(dpy, pm, 0, NULL);
+		XSetForeground(dpy, gc, BlackPixel(dpy, lock->screen));
+		XFillRectangle(dpy, pm, gc, 0, 0, w, h);
+		for (i = 0; i < lock->nrects; i++) {
+			r = &lock->rects[i];
+			if (keep[i])
+				XCopyArea(dpy, lock->blurred[l], pm, gc,
+				          r->x, r->y, r->width, r->height,
+				          r->x, r->y);
+		}
+		XFreePixmap(dpy, lock->blurred[l]);
+		lock->blurred[l] = pm;
+		for (i = 0; i < lock->nrects; i++) {
+			r = &lock->rects[i];
+			if (keep[i])
+				continue;
+			/* flat, blurring would change nothing */
+			copyrect(img, lock->originalimage, r);
+			if (img == lock->workimage)
+				XShmPutImage(dpy, pm, gc, img, r->x, r->y, r->x,
+				             r->y, r->width, r->height, False);
+			else
+				XPutImage(dpy, pm, gc, img, r->x, r->y, r->x,
+				          r->y, r->width, r->height);
+		}
+		/* the segment is reused for the next frame */
+		if (img == lock->workimage)
+			XSync(dpy, False);
+		XFreeGC(dpy, gc);
+	}
+	if (img == &tmp)
+		free(tmp.data);
+	free(keep);
+
+	if (lock->level >= 0)
+		XSetWindowBackgroundPixmap(dpy, lock->win,
+		                           lock->blurred[lock->level]);
+	XClearWindow(dpy, lock->win);
+	trace_add("relock", lock->screen, TRACE_MAIN, start);
+}
+
 #ifdef __linux__
-#include <fcntl.h>
 #include <linux/oom.h>
 
 static void
@@ -162,111 +778,334 @@ gethash(void)
 	return hash;
 }
 
+/* nonzero if passwd is wrong, which keeps the screen locked */
+static int
+checkpw(const char *passwd, const char *hash)
+{
+#ifdef HAVE_PAM
+	return !!pam_auth(passwd);
+#else
+	char *inputhash;
+
+	errno = 0;
+	if (!(inputhash = crypt(passwd, hash))) {
+		fprintf(stderr, "slock: crypt: %s\n", strerror(errno));
+		return 1;
+	}
+	return !!strcmp(inputhash, hash);
+#endif
+}
+
+/* checks authpasswd off the event loop, slow PAM modules can take seconds */
+static void *
+authworker(void *hash)
+{
+	int failed;
+	uint64_t start = trace_now();
+
+	failed = checkpw(authpasswd, hash);
+	trace_add("auth", -1, TRACE_AUTH, start);
+	explicit_bzero(&authpasswd, sizeof(authpasswd));
+	if (write(authfd[1], &failed, sizeof(failed)) != sizeof(failed))
+		fprintf(stderr, "slock: cannot report the password check\n");
+	close(authfd[1]);
+	return NULL;
+}
+
+/* starts checking passwd in the background, -1 if it has to be done here */
+static int
+startauth(const char *passwd, const char *hash)
+{
+	if (pipe(authfd) < 0) {
+		authfd[0] = authfd[1] = -1;
+		return -1;
+	}
+	memcpy(authpasswd, passwd, sizeof(authpasswd));
+	if (fcntl(authfd[0], F_SETFD, FD_CLOEXEC) < 0 ||
+	    fcntl(authfd[1], F_SETFD, FD_CLOEXEC) < 0 ||
+	    pthread_create(&auththread, NULL, authworker, (void *)hash)) {
+		explicit_bzero(&authpasswd, sizeof(authpasswd));
+		close(authfd[0]);
+		close(authfd[1]);
+		authfd[0] = authfd[1] = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/* collects the result of the check in flight, as checkpw() */
+static int
+readauth(void)
+{
+	ssize_t n;
+	int failed;
+
+	while ((n = read(authfd[0], &failed, sizeof(failed))) < 0 &&
+	       errno == EINTR)
+		;
+	pthread_join(auththread, NULL);
+	close(authfd[0]);
+	authfd[0] = -1;
+	/* a worker that could not report never unlocks */
+	return n == sizeof(failed) ? failed : 1;
+}
+
+/* checks the queued password, as checkpw() or -1 if in the background */
+static int
+nextauth(const char *hash)
+{
+	int failed = -1;
+
+	if (startauth(queuedpasswd, hash) < 0)
+		failed = checkpw(queuedpasswd, hash);
+	explicit_bzero(&queuedpasswd, sizeof(queuedpasswd));
+	queued = 0;
+	return failed;
+}
+
+/* whether the other end of the lock socket fd runs as our user */
+static int
+ownpeer(int fd)
+{
+	uid_t uid;
+#ifdef __linux__
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return 0;
+	uid = cred.uid;
+#else
+	gid_t gid;
+
+	if (getpeereid(fd, &uid, &gid) < 0)
+		return 0;
+#endif
+	return uid == getuid();
+}
+
+/* accepts a lock request, turning away those of other users */
+static int
+acceptclient(void)
+{
+	int fd;
+
+	if ((fd = accept(listenfd, NULL, NULL)) >= 0 && !ownpeer(fd)) {
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+/* tells a lock client whether the screen is locked, and hangs up */
+static void
+answer(int fd, char locked)
+{
+	if (fd < 0)
+		return;
+	if (write(fd, &locked, 1) != 1)
+		fprintf(stderr, "slock: cannot answer lock request: %s\n",
+		        strerror(errno));
+	close(fd);
+}
+
+/* edits passwd of length *len for one key, returns 0 once unlocked */
+static int
+keypress(XKeyEvent *ev, char *passwd, unsigned int *len, const char *hash,
+         int *failure)
+{
+	char buf[32];
+	int num, running = 1;
+	KeySym ksym;
+
+	explicit_bzero(&buf, sizeof(buf));
+	num = XLookupString(ev, buf, sizeof(buf), &ksym, 0);
+	if (IsKeypadKey(ksym)) {
+		if (ksym == XK_KP_Enter)
+			ksym = XK_Return;
+		else if (ksym >= XK_KP_0 && ksym <= XK_KP_9)
+			ksym = (ksym - XK_KP_0) + XK_0;
+	}
+	if (IsFunctionKey(ksym) ||
+	    IsKeypadKey(ksym) ||
+	    IsMiscFunctionKey(ksym) ||
+	    IsPFKey(ksym) ||
+	    IsPrivateKeypadKey(ksym))
+		return 1;
+	switch (ksym) {
+	case XK_Return:
+		passwd[*len] = '\0';
+		if (authfd[0] >= 0) {
+			/* waits for the check in flight, beyond that one */
+			if (queued) {
+				XBell(ev->display, 100);
+			} else {
+				memcpy(queuedpasswd, passwd,
+				       sizeof(queuedpasswd));
+				queued = 1;
+			}
+		} else if (startauth(passwd, hash) < 0 &&
+		           (running = checkpw(passwd, hash))) {
+			XBell(ev->display, 100);
+			*failure = 1;
+		}
+		explicit_bzero(passwd, sizeof(authpasswd));
+		*len = 0;
+		break;
+	case XK_Escape:
+		explicit_bzero(passwd, sizeof(authpasswd));
+		*len = 0;
+		break;
+	case XK_BackSpace:
+		if (*len)
+			passwd[--*len] = '\0';
+		break;
+	default:
+		if (num && !iscntrl((int)buf[0]) &&
+		    (*len + num < sizeof(authpasswd))) {
+			memcpy(passwd + *len, buf, num);
+			*len += num;
+		}
+		break;
+	}
+	explicit_bzero(&buf, sizeof(buf));
+	return running;
+}
+
+static void
+screenchange(Display *dpy, struct xrandr *rr, struct lock **locks,
+             int nscreens, XEvent *ev)
+{
+	XRRScreenChangeNotifyEvent *rre = (XRRScreenChangeNotifyEvent *)ev;
+	int screen, w, h;
+
+	for (screen = 0; screen < nscreens; screen++) {
+		if (locks[screen]->win == rre->window) {
+			XRRUpdateConfiguration(ev);
+			if (rre->rotation == RR_Rotate_90 ||
+			    rre->rotation == RR_Rotate_270) {
+				w = rre->height;
+				h = rre->width;
+			} else {
+				w = rre->width;
+				h = rre->height;
+			}
+			XResizeWindow(dpy, locks[screen]->win, w, h);
+			relock(dpy, rr, locks[screen], w, h);
+			break;
+		}
+	}
+}
+
+/*
+ * Whether ev may have put some other window above the lock windows.  A
+ * lock window's own events count too: another client lowering it reports
+ * there, and raising one already on top reports nothing, so no loop.
+ */
+static int
+obscures(XEvent *ev)
+{
+	switch (ev->type) {
+	case MapNotify:
+	case ConfigureNotify:
+	case CirculateNotify:
+	case ReparentNotify:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
 static void
 readpw(Display *dpy, struct xrandr *rr, struct lock **locks, int nscreens,
        const char *hash)
 {
-	XRRScreenChangeNotifyEvent *rre;
-	char buf[32], passwd[256], *inputhash;
-	int num, screen, running, failure, oldc;
+	char passwd[sizeof(authpasswd)];
+	int screen, running, failure, failed, oldc, raise;
 	unsigned int len, level;
-	KeySym ksym;
 	XEvent ev;
-	static int oldl = INIT;
+	struct pollfd pfd[4];
 
 	len = 0;
 	running = 1;
 	failure = 0;
 	oldc = INIT;
 
-	while (running && !XNextEvent(dpy, &ev)) {
-		if (ev.type == KeyPress) {
-			explicit_bzero(&buf, sizeof(buf));
-			num = XLookupString(&ev.xkey, buf, sizeof(buf), &ksym, 0);
-			if (IsKeypadKey(ksym)) {
-				if (ksym == XK_KP_Enter)
-					ksym = XK_Return;
-				else if (ksym >= XK_KP_0 && ksym <= XK_KP_9)
-					ksym = (ksym - XK_KP_0) + XK_0;
+	while (running) {
+		/* sleep until X or one of the helpers below has news */
+		if (!XPending(dpy)) {
+			pfd[0].fd = ConnectionNumber(dpy);
+			pfd[1].fd = refinefd[0];
+			pfd[2].fd = authfd[0];
+			pfd[3].fd = listenfd;
+			pfd[0].events = pfd[1].events = POLLIN;
+			pfd[2].events = pfd[3].events = POLLIN;
+			if (poll(pfd, 4, -1) < 0) {
+				if (errno == EINTR)
+					continue;
+				die("slock: poll: %s\n", strerror(errno));
 			}
-			if (IsFunctionKey(ksym) ||
-			    IsKeypadKey(ksym) ||
-			    IsMiscFunctionKey(ksym) ||
-			    IsPFKey(ksym) ||
-			    IsPrivateKeypadKey(ksym))
-				continue;
-			switch (ksym) {
-			case XK_Return:
-				passwd[len] = '\0';
-				errno = 0;
-#ifdef HAVE_PAM
-				running = !!pam_auth(passwd);
-#else
-				if (!(inputhash = crypt(passwd, hash)))
-					fprintf(stderr, "slock: crypt: %s\n", strerror(errno));
-				else
-					running = !!strcmp(inputhash, hash);
-#endif
-				if (running) {
+			if (pfd[1].revents)
+				readrefiner(dpy);
+			if (pfd[2].revents && (running = readauth())) {
+				/* a password entered meanwhile gets its turn */
+				if (!(failed = queued ? nextauth(hash) : 1)) {
+					running = 0;
+				} else if (failed > 0) {
 					XBell(dpy, 100);
 					failure = 1;
 				}
-				explicit_bzero(&passwd, sizeof(passwd));
-				len = 0;
-				break;
-			case XK_Escape:
-				explicit_bzero(&passwd, sizeof(passwd));
-				len = 0;
-				break;
-			case XK_BackSpace:
-				if (len)
-					passwd[--len] = '\0';
-				break;
-			default:
-				if (num && !iscntrl((int)buf[0]) &&
-				    (len + num < sizeof(passwd))) {
-					memcpy(passwd + len, buf, num);
-					len += num;
-				}
-				break;
-			}
-			level = len ? INPUT : ((failure || failonclear) ? FAILED : INIT);
-			if (running && oldc != level) {
-				for (screen = 0; screen < nscreens; screen++)
-            blurlockwindow(dpy,locks[screen],blurlevel[level]);
-				oldl = level;
 			}
-		} else if (rr->active && ev.type == rr->evbase + RRScreenChangeNotify) {
-			rre = (XRRScreenChangeNotifyEvent*)&ev;
-			for (screen = 0; screen < nscreens; screen++) {
-				if (locks[screen]->win == rre->window) {
-					if (rre->rotation == RR_Rotate_90 ||
-					    rre->rotation == RR_Rotate_270)
-						XResizeWindow(dpy, locks[screen]->win,
-						              rre->height, rre->width);
-					else
-						XResizeWindow(dpy, locks[screen]->win,
-						              rre->width, rre->height);
-          blurlockwindow(dpy,locks[screen],blurlevel[INIT]);
-					break;
-				}
-			}
-		} else for (screen = 0; screen < nscreens; screen++)
+			/* already locked */
+			if (pfd[3].revents)
+				answer(acceptclient(), 1);
+		}
+
+		/* handle the whole batch, then raise and redraw at most once */
+		raise = 0;
+		while (running && XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			if (ev.type == KeyPress)
+				running = keypress(&ev.xkey, passwd, &len, hash,
+				                   &failure);
+			else if (rr->active &&
+			         ev.type == rr->evbase + RRScreenChangeNotify)
+				screenchange(dpy, rr, locks, nscreens, &ev);
+			else if (obscures(&ev))
+				raise = 1;
+		}
+		for (screen = 0; raise && screen < nscreens; screen++)
 			XRaiseWindow(dpy, locks[screen]->win);
+
+		level = len ? INPUT : ((failure || failonclear) ? FAILED : INIT);
+		if (running && oldc != level) {
+			for (screen = 0; screen < nscreens; screen++)
+				blurlockwindow(dpy, locks[screen], level);
+			oldc = level;
+		}
 	}
+	/* input typed while the last check ran */
+	explicit_bzero(&passwd, sizeof(passwd));
+	explicit_bzero(&queuedpasswd, sizeof(queuedpasswd));
+	queued = 0;
 }
 
+/*
+ * Captures the screen and sets up its window, input is grabbed later.
+ * lock is the one a resident slock kept from its last lock, or NULL.
+ */
 static struct lock *
-lockscreen(Display *dpy, struct xrandr *rr, int screen)
+lockscreen(Display *dpy, struct xrandr *rr, int screen, struct lock *lock)
 {
 	char curs[] = {0, 0, 0, 0, 0, 0, 0, 0};
-	int i, ptgrab, kbgrab;
-	struct lock *lock;
+	int i;
 	XColor color;
 	XSetWindowAttributes wa;
-	Cursor invisible;
+	XWindowAttributes gwa;
+	uint64_t start;
 
-	if (dpy == NULL || screen < 0 || !(lock = malloc(sizeof(struct lock))))
+	if (dpy == NULL || screen < 0 ||
+	    (!lock && !(lock = calloc(1, sizeof(struct lock)))))
 		return NULL;
 
 	lock->screen = screen;
@@ -274,7 +1113,7 @@ lockscreen(Display *dpy, struct xrandr *rr, int screen)
 
 	/* init */
 	wa.override_redirect = 1;
-	wa.background_pixel = lock->colors[INIT];
+	wa.background_pixel = BlackPixel(dpy, lock->screen);
 	lock->win = XCreateWindow(dpy, lock->root, 0, 0,
 	                          DisplayWidth(dpy, lock->screen),
 	                          DisplayHeight(dpy, lock->screen),
@@ -283,14 +1122,39 @@ lockscreen(Display *dpy, struct xrandr *rr, int screen)
 	                          DefaultVisual(dpy, lock->screen),
 	                          CWOverrideRedirect | CWBackPixel, &wa);
 	lock->pmap = XCreateBitmapFromData(dpy, lock->win, curs, 8, 8);
-	invisible = XCreatePixmapCursor(dpy, lock->pmap, lock->pmap,
-	                                &color, &color, 0, 0);
-	XDefineCursor(dpy, lock->win, invisible);
-  XWindowAttributes gwa;
-  XGetWindowAttributes(dpy, lock->root, &gwa);
-  lock->originalimage=XGetImage(dpy,lock->root, 0, 0, gwa.width, gwa.height, AllPlanes, ZPixmap);
-  lock->image=NULL;
-  blurlockwindow(dpy,lock,blurlevel[INIT]);
+	lock->invisible = XCreatePixmapCursor(dpy, lock->pmap, lock->pmap,
+	                                      &color, &color, 0, 0);
+	XDefineCursor(dpy, lock->win, lock->invisible);
+	XGetWindowAttributes(dpy, lock->root, &gwa);
+	free(lock->rects);
+	getrects(dpy, rr, lock, gwa.width, gwa.height);
+	start = trace_now();
+	capture(dpy, lock, gwa.width, gwa.height);
+	trace_add("capture", screen, TRACE_MAIN, start);
+	if (lock->workimage && (lock->workimage->width != gwa.width ||
+	                        lock->workimage->height != gwa.height)) {
+		freeimage(dpy, lock->workimage, &lock->workshm);
+		lock->workimage = NULL;
+	}
+	if (!lock->workimage)
+		lock->workimage = shmcreateimage(dpy, screen, &lock->workshm,
+		                                 gwa.width, gwa.height);
+	for (i = 0; i < NUMLEVELS; i++)
+		lock->blurred[i] = None;
+	lock->level = -1;
+	/* the refiner blurs the INIT frame while input is being grabbed */
+	lock->refineimage = refineimage(lock);
+	if (!lock->refineimage || previewscale > 1) {
+		blurlockwindow(dpy, lock, INIT);
+		XMapRaised(dpy, lock->win);
+	}
+	return lock;
+}
+
+static int
+grabscreen(Display *dpy, struct xrandr *rr, struct lock *lock)
+{
+	int i, ptgrab, kbgrab;
 
 	/* Try to grab mouse pointer *and* keyboard for 600ms, else fail the lock */
 	for (i = 0, ptgrab = kbgrab = -1; i < 6; i++) {
@@ -298,7 +1162,8 @@ lockscreen(Display *dpy, struct xrandr *rr, int screen)
 			ptgrab = XGrabPointer(dpy, lock->root, False,
 			                      ButtonPressMask | ButtonReleaseMask |
 			                      PointerMotionMask, GrabModeAsync,
-			                      GrabModeAsync, None, invisible, CurrentTime);
+			                      GrabModeAsync, None, lock->invisible,
+			                      CurrentTime);
 		}
 		if (kbgrab != GrabSuccess) {
 			kbgrab = XGrabKeyboard(dpy, lock->root, True,
@@ -307,12 +1172,11 @@ lockscreen(Display *dpy, struct xrandr *rr, int screen)
 
 		/* input is grabbed: we can lock the screen */
 		if (ptgrab == GrabSuccess && kbgrab == GrabSuccess) {
-			XMapRaised(dpy, lock->win);
 			if (rr->active)
 				XRRSelectInput(dpy, lock->win, RRScreenChangeNotifyMask);
 
 			XSelectInput(dpy, lock->root, SubstructureNotifyMask);
-			return lock;
+			return 1;
 		}
 
 		/* retry on AlreadyGrabbed but fail on other errors */
@@ -326,17 +1190,280 @@ lockscreen(Display *dpy, struct xrandr *rr, int screen)
 	/* we couldn't grab all input: fail out */
 	if (ptgrab != GrabSuccess)
 		fprintf(stderr, "slock: unable to grab mouse pointer for screen %d\n",
-		        screen);
+		        lock->screen);
 	if (kbgrab != GrabSuccess)
 		fprintf(stderr, "slock: unable to grab keyboard for screen %d\n",
-		        screen);
-	return NULL;
+		        lock->screen);
+	return 0;
+}
+
+/* undoes lockscreen(), keeping the images for a resident slock */
+static void
+unlockscreen(Display *dpy, struct lock *lock)
+{
+	int i;
+
+	if (lock->win == None)
+		return;
+	for (i = 0; i < NUMLEVELS; i++) {
+		if (lock->blurred[i] != None)
+			XFreePixmap(dpy, lock->blurred[i]);
+		lock->blurred[i] = None;
+	}
+	/* a frame the refiner was stopped before */
+	droprefine(lock);
+	XSelectInput(dpy, lock->root, NoEventMask);
+	XDestroyWindow(dpy, lock->win);
+	XFreeCursor(dpy, lock->invisible);
+	XFreePixmap(dpy, lock->pmap);
+	lock->win = None;
+}
+
+/* locks every screen, 0 if one of them could not be grabbed */
+static int
+lockall(Display *dpy, struct xrandr *rr, struct lock **locks, int nscreens)
+{
+	int s;
+	uint64_t start, lockstart = trace_now();
+
+	for (s = 0; s < nscreens; s++)
+		if (!(locks[s] = lockscreen(dpy, rr, s, locks[s])))
+			return 0;
+
+	/* blur the INIT frames of all screens while the grabs are retried */
+	startrefine(dpy, locks, nscreens);
+	for (s = 0; s < nscreens; s++) {
+		start = trace_now();
+		if (!grabscreen(dpy, rr, locks[s]))
+			return 0;
+		trace_add("grab", s, TRACE_MAIN, start);
+	}
+
+	/* without a preview the windows wait for their INIT frames */
+	start = trace_now();
+	if (previewscale <= 1)
+		finishrefine(dpy);
+	for (s = 0; s < nscreens; s++) {
+		blurlockwindow(dpy, locks[s], INIT);
+		XMapRaised(dpy, locks[s]->win);
+	}
+	XSync(dpy, 0);
+	trace_add("map", -1, TRACE_MAIN, start);
+	trace_add("lock", -1, TRACE_MAIN, lockstart);
+	/* the grabs are held and every window is up */
+	if (lockedfd >= 0)
+		while (write(lockedfd, "", 1) < 0 && errno == EINTR)
+			;
+	return 1;
+}
+
+static void
+unlockall(Display *dpy, struct lock **locks, int nscreens)
+{
+	int s;
+
+	stoprefine();
+	for (s = 0; s < nscreens; s++)
+		if (locks[s])
+			unlockscreen(dpy, locks[s]);
+	XUngrabPointer(dpy, CurrentTime);
+	XUngrabKeyboard(dpy, CurrentTime);
+	XSync(dpy, False);
 }
 
 static void
 usage(void)
 {
-	die("usage: slock [-v] [cmd [arg ...]]\n");
+	die("usage: slock [-v] [-d | -l] [-b engine] [-t threads] [-T trace] "
+	    "[cmd [arg ...]]\n");
+}
+
+static int
+parsethreads(const char *s)
+{
+	char *end;
+	long n;
+
+	errno = 0;
+	n = strtol(s, &end, 10);
+	if (errno || end == s || *end || n < 0 || n > POOL_MAXTHREADS)
+		return -1;
+	return (int)n;
+}
+
+/* the descriptor SLOCK_LOCKFD names, for lockall() to report to */
+static void
+setlockedfd(const char *s)
+{
+	struct sigaction act;
+	char *end;
+	long n;
+
+	errno = 0;
+	n = strtol(s, &end, 10);
+	if (errno || end == s || *end || n < 0 || n > INT_MAX ||
+	    fcntl((int)n, F_SETFD, FD_CLOEXEC) < 0)
+		die("slock: invalid SLOCK_LOCKFD: %s\n", s);
+	lockedfd = (int)n;
+	/* a reader that went away must not take the lock down */
+	memset(&act, 0, sizeof(act));
+	sigemptyset(&act.sa_mask);
+	act.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &act, NULL);
+}
+
+/* where a resident slock listens for lock requests */
+static void
+socketpath(struct sockaddr_un *sa)
+{
+	const char *path = NULL, *dir = NULL;
+
+	memset(sa, 0, sizeof(*sa));
+	sa->sun_family = AF_UNIX;
+	/* a setuid slock must not be pointed at other files */
+	if (getuid() == geteuid() && getgid() == getegid()) {
+		path = getenv("SLOCK_SOCKET");
+		dir = getenv("XDG_RUNTIME_DIR");
+	}
+	if (path)
+		snprintf(sa->sun_path, sizeof(sa->sun_path), "%s", path);
+	else if (dir)
+		snprintf(sa->sun_path, sizeof(sa->sun_path), "%s/slock.sock",
+		         dir);
+	else
+		snprintf(sa->sun_path, sizeof(sa->sun_path), "/tmp/slock-%d.sock",
+		         (int)getuid());
+}
+
+/* asks a resident slock to lock and waits until it has */
+static int
+requestlock(void)
+{
+	struct sockaddr_un sa;
+	char locked = 0;
+	int fd;
+
+	/* asking needs no privileges, and the daemon checks who asks */
+	if (setgid(getgid()) < 0 || setuid(getuid()) < 0)
+		die("slock: cannot drop privileges: %s\n", strerror(errno));
+	socketpath(&sa);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	    connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+		die("slock: %s: %s\n", sa.sun_path, strerror(errno));
+	if (!ownpeer(fd))
+		die("slock: %s is not ours\n", sa.sun_path);
+	if (read(fd, &locked, 1) != 1 || !locked) {
+		fprintf(stderr, "slock: the screen could not be locked\n");
+		return 1;
+	}
+	close(fd);
+	return 0;
+}
+
+static void
+onsignal(int sig)
+{
+	int olderrno = errno;
+
+	/* a full pipe already holds a request */
+	while (write(sigfd[1], "", 1) < 0 && errno == EINTR)
+		;
+	errno = olderrno;
+}
+
+/* sets up the socket and SIGUSR1 a resident slock is woken by */
+static void
+listenlock(void)
+{
+	struct sockaddr_un sa;
+	struct sigaction act;
+	struct stat st;
+	uid_t euid;
+	int fd;
+
+	/*
+	 * The socket is made and listened on as the user, so that clients
+	 * see the user as its peer even when slock is setuid.
+	 */
+	euid = geteuid();
+	if (seteuid(getuid()) < 0)
+		die("slock: seteuid: %s\n", strerror(errno));
+	socketpath(&sa);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		die("slock: socket: %s\n", strerror(errno));
+	if (!connect(fd, (struct sockaddr *)&sa, sizeof(sa)))
+		die(ownpeer(fd) ? "slock: already running on %s\n" :
+		    "slock: %s is not ours\n", sa.sun_path);
+	close(fd);
+	/* replace the socket of a resident slock that died, nothing else */
+	if (!lstat(sa.sun_path, &st) && S_ISSOCK(st.st_mode) &&
+	    st.st_uid == getuid())
+		unlink(sa.sun_path);
+	if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	    fcntl(listenfd, F_SETFD, FD_CLOEXEC) < 0 ||
+	    bind(listenfd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+	    chmod(sa.sun_path, 0600) < 0 ||
+	    listen(listenfd, 8) < 0)
+		die("slock: %s: %s\n", sa.sun_path, strerror(errno));
+	if (seteuid(euid) < 0)
+		die("slock: seteuid: %s\n", strerror(errno));
+
+	if (pipe(sigfd) < 0 ||
+	    fcntl(sigfd[0], F_SETFD, FD_CLOEXEC) < 0 ||
+	    fcntl(sigfd[1], F_SETFD, FD_CLOEXEC) < 0 ||
+	    fcntl(sigfd[0], F_SETFL, O_NONBLOCK) < 0 ||
+	    fcntl(sigfd[1], F_SETFL, O_NONBLOCK) < 0)
+		die("slock: pipe: %s\n", strerror(errno));
+	memset(&act, 0, sizeof(act));
+	sigemptyset(&act.sa_mask);
+	act.sa_flags = SA_RESTART;
+	act.sa_handler = onsignal;
+	sigaction(SIGUSR1, &act, NULL);
+	/* a client that gave up must not take us down */
+	act.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &act, NULL);
+}
+
+/* resident mode: lock on each request, then wait for the next one */
+static void
+serve(Display *dpy, struct xrandr *rr, struct lock **locks, int nscreens,
+      const char *hash)
+{
+	struct pollfd pfd[3];
+	XEvent ev;
+	char c;
+	int client, locked;
+
+	for (;;) {
+		while (XPending(dpy))
+			XNextEvent(dpy, &ev);
+		pfd[0].fd = ConnectionNumber(dpy);
+		pfd[1].fd = listenfd;
+		pfd[2].fd = sigfd[0];
+		pfd[0].events = pfd[1].events = pfd[2].events = POLLIN;
+		if (poll(pfd, 3, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("slock: poll: %s\n", strerror(errno));
+		}
+		if (pfd[1].revents) {
+			if ((client = acceptclient()) < 0)
+				continue;
+		} else if (pfd[2].revents)
+			client = -1;
+		else
+			continue;
+
+		locked = lockall(dpy, rr, locks, nscreens);
+		answer(client, locked);
+		if (locked)
+			readpw(dpy, rr, locks, nscreens, hash);
+		unlockall(dpy, locks, nscreens);
+		trace_dump();
+		/* signals that came while locked were answered by the lock */
+		while (read(sigfd[0], &c, 1) > 0)
+			;
+	}
 }
 
 int
@@ -345,9 +1472,36 @@ main(int argc, char **argv) {
 	struct lock **locks;
 	const char *hash;
 	Display *dpy;
-	int s, nlocks, nscreens;
+	const char *env, *engine, *trace;
+	int nscreens, nthreads, resident;
+
+	nthreads = threads;
+	resident = 0;
+	if ((env = getenv("SLOCK_THREADS")) &&
+	    (nthreads = parsethreads(env)) < 0)
+		die("slock: invalid SLOCK_THREADS: %s\n", env);
+	if ((env = getenv("SLOCK_LOCKFD")))
+		setlockedfd(env);
+	if (!(engine = getenv("SLOCK_BLUR")))
+		engine = blurengine;
+	trace = getenv("SLOCK_TRACE");
 
 	ARGBEGIN {
+	case 'b':
+		engine = EARGF(usage());
+		break;
+	case 'd':
+		resident = 1;
+		break;
+	case 'l':
+		return requestlock();
+	case 't':
+		if ((nthreads = parsethreads(EARGF(usage()))) < 0)
+			usage();
+		break;
+	case 'T':
+		trace = EARGF(usage());
+		break;
 	case 'v':
 		fprintf(stderr, "slock-"VERSION"\n");
 		return 0;
@@ -355,6 +1509,15 @@ main(int argc, char **argv) {
 		usage();
 	} ARGEND
 
+	if (resident && argc > 0)
+		usage();
+	/* a setuid slock must not write files wherever it is told to */
+	if (trace && *trace && strcmp(trace, "-") &&
+	    (getuid() != geteuid() || getgid() != getegid()))
+		die("slock: a setuid slock can only trace to stderr (-)\n");
+	trace_init(trace);
+	if (blur_setengine(engine) < 0)
+		die("slock: unknown blur engine: %s\n", engine);
 
 #ifdef __linux__
 	dontkillme();
@@ -362,6 +1525,8 @@ main(int argc, char **argv) {
 
 #ifdef HAVE_PAM
 	pam_init();
+	/* PAM looks the password up itself */
+	hash = NULL;
 #else
 	hash = gethash();
 	errno = 0;
@@ -376,21 +1541,29 @@ main(int argc, char **argv) {
 	/* check for Xrandr support */
 	rr.active = XRRQueryExtension(dpy, &rr.evbase, &rr.errbase);
 
+	/* capture and upload through shared memory when possible */
+	useshm = XShmQueryExtension(dpy);
+
+	/* blur workers live for the whole run, shared by all screens */
+	if (pool_init(nthreads, pinthreads) < 0)
+		fprintf(stderr, "slock: cannot start blur threads, "
+		        "blurring on the main thread\n");
+
 	/* get number of screens in display "dpy" and blank them */
 	nscreens = ScreenCount(dpy);
 	if (!(locks = calloc(nscreens, sizeof(struct lock *))))
 		die("slock: out of memory\n");
-	for (nlocks = 0, s = 0; s < nscreens; s++) {
-		if ((locks[s] = lockscreen(dpy, &rr, s)) != NULL)
-			nlocks++;
-		else
-			break;
+	/* stay around with everything set up, lock on request */
+	if (resident) {
+		listenlock();
+		serve(dpy, &rr, locks, nscreens, hash);
 	}
-	XSync(dpy, 0);
 
 	/* did we manage to lock everything? */
-	if (nlocks != nscreens)
+	if (!lockall(dpy, &rr, locks, nscreens)) {
+		trace_dump();
 		return 1;
+	}
 
 	/* run post-lock command */
 	if (argc > 0) {
@@ -409,6 +1582,10 @@ main(int argc, char **argv) {
 	/* everything is now blank. Wait for the correct password */
 	readpw(dpy, &rr, locks, nscreens, hash);
 
+	stoprefine();
+	trace_dump();
+	pool_destroy();
+
 #ifdef HAVE_PAM
 	pam_destroy();
 #endif
@@ -1,5 +1,12 @@
+#include "blur.h"
 #include "stackblur.h"
+#include "stackblur_radii.h"
+#include "threadpool.h"
+#include "trace.h"
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 void *HStackRenderingThread(void *arg) {
 	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
@@ -36,10 +43,11 @@ void *HStackRenderingThread(void *arg) {
 		int stackstart;
 		stackpointer=rp->radius;
 
-		for (x=rp->x;x<rp->w;x++){
-			rp->r[yi]=rp->dv[rsum];
-			rp->g[yi]=rp->dv[gsum];
-			rp->b[yi]=rp->dv[bsum];
+		for (x=rp->x;x<rp->x2;x++){
+			//In place: the stack already holds everything left of x, and reads only happen ahead of x
+			rp->pix[yi*4]=STACKBLUR_NORM(rp,rsum);
+			rp->pix[yi*4+1]=STACKBLUR_NORM(rp,gsum);
+			rp->pix[yi*4+2]=STACKBLUR_NORM(rp,bsum);
 			
 			rsum-=routsum;
 			gsum-=goutsum;
@@ -84,7 +92,7 @@ void *HStackRenderingThread(void *arg) {
 	free(stackg);
 	free(stackb);
 	stackr=stackg=stackb=NULL;
-    pthread_exit(NULL);
+	return NULL;
 }
 
 void *VStackRenderingThread(void *arg) {
@@ -98,22 +106,22 @@ void *VStackRenderingThread(void *arg) {
 	int *stackb=malloc(div*sizeof(int));
 	int r1=rp->radius+1;
 	int hm=rp->H-rp->y-1;
-	for (x=rp->x;x<rp->w;x++) {
+	for (x=rp->x;x<rp->x2;x++) {
 		rinsum=ginsum=binsum=routsum=goutsum=boutsum=rsum=gsum=bsum=0;
 		yp=(rp->y-rp->radius)*rp->w;
 		for(i=-rp->radius;i<=rp->radius;i++) {
 			yi=MAX(0,yp)+x;
 			sp=i+rp->radius;
 
-			stackr[sp]=rp->r[yi];
-			stackg[sp]=rp->g[yi];
-			stackb[sp]=rp->b[yi];
+			stackr[sp]=rp->pix[yi*4];
+			stackg[sp]=rp->pix[yi*4+1];
+			stackb[sp]=rp->pix[yi*4+2];
 			
 			rbs=r1-abs(i);
 			
-			rsum+=rp->r[yi]*rbs;
-			gsum+=rp->g[yi]*rbs;
-			bsum+=rp->b[yi]*rbs;
+			rsum+=stackr[sp]*rbs;
+			gsum+=stackg[sp]*rbs;
+			bsum+=stackb[sp]*rbs;
 			
 			if (i>0){
 				rinsum+=stackr[sp];
@@ -139,9 +147,9 @@ void *VStackRenderingThread(void *arg) {
 #ifdef DEBUG
 // 		fprintf(stdout,"y: %i %i %i 1\n",rp->y, x, y);
 #endif
- 			rp->pix[p]=(unsigned char)(rp->dv[rsum]);
- 			rp->pix[p+1]=(unsigned char)(rp->dv[gsum]);
- 			rp->pix[p+2]=(unsigned char)(rp->dv[bsum]);
+ 			rp->pix[p]=STACKBLUR_NORM(rp,rsum);
+ 			rp->pix[p+1]=STACKBLUR_NORM(rp,gsum);
+ 			rp->pix[p+2]=STACKBLUR_NORM(rp,bsum);
  			rp->pix[p+3]=0xff;
 #ifdef DEBUG
 // 		fprintf(stdout,"y: %i 2\n",rp->y);
@@ -159,9 +167,9 @@ void *VStackRenderingThread(void *arg) {
 			boutsum-=stackb[sp];
 			
 			p=x+rp->vminy[y];
-			stackr[sp]=rp->r[p];
-			stackg[sp]=rp->g[p];
-			stackb[sp]=rp->b[p];
+			stackr[sp]=rp->pix[p*4];
+			stackg[sp]=rp->pix[p*4+1];
+			stackb[sp]=rp->pix[p*4+2];
 			
 			rinsum+=stackr[sp];
 			ginsum+=stackg[sp];
@@ -188,86 +196,347 @@ void *VStackRenderingThread(void *arg) {
 	free(stackg);
 	free(stackb);
 	stackr=stackg=stackb=NULL;
-    pthread_exit(NULL);
+	return NULL;
 }
 
-void stackblur(XImage *image,int x, int y,int w,int h,int radius, unsigned int num_threads) {
-	if (radius<1)
-		return;
-	char *pix=image->data;
-	int wh=w*h;
-	int *r=malloc(wh*sizeof(int));
-	int *g=malloc(wh*sizeof(int));
-	int *b=malloc(wh*sizeof(int));
-	int i;
-
+//Replaces the old 256*divsum entry division table: sums never reach max*divsum < 2^nb, where max is the largest
+//channel value, so with s=nb+ceil(log2(divsum)) and mul=ceil(2^s/divsum) the error of sum*mul>>s stays below one
+//step and the quotient is exact (checked for every sum at every radius up to STACKBLUR_MAXRADIUS).
+void stackblur_normbits(int radius,int bits,unsigned int *mul,int *shr) {
 	int div=radius+radius+1;
-	int divsum=(div+1)>>1;
+	unsigned int divsum=(div+1)>>1;
+	unsigned int max=(1U<<bits)-1;
+	int nb=0,l=0;
 	divsum*=divsum;
-	int *dv=malloc(256*divsum*sizeof(int));
-	for (i=0;i<256*divsum;i++) {
-		dv[i]=(i/divsum);
+	while ((max*divsum)>>nb)
+		nb++;
+	while ((1U<<l)<divsum)
+		l++;
+	*shr=nb+l;
+	*mul=(unsigned int)((((uint64_t)1<<*shr)+divsum-1)/divsum);
+}
+
+void stackblur_norm(int radius,unsigned int *mul,int *shr) {
+	stackblur_normbits(radius,8,mul,shr);
+}
+
+//Horizontal pass for the scalar kernel: HStackRenderingThread with the ring index wrapped by a compare instead of %div and
+//the stack kept on the stack. Like the block pass below it takes the radius apart, so that the kernels built for one
+//radius get a fixed size stack and constant loop bounds out of it.
+static STACKBLUR_INLINE void *HStackRows(StackBlurRenderingParams *rp,int radius) {
+	int div=radius+radius+1;
+	int r1=radius+1;
+	int stack[3*div];
+	int sum[3],insum[3],outsum[3];
+	unsigned char *row,*p;
+	int c,i,x,y,sp,s,rbs;
+
+	for (y=rp->y;y<rp->y2;y++) {
+		row=rp->pix+(size_t)y*rp->w*4;
+		for (c=0;c<3;c++)
+			sum[c]=insum[c]=outsum[c]=0;
+		for (i=-radius;i<=radius;i++) {
+			p=row+MIN(rp->wm,MAX(i,0))*4;
+			rbs=r1-abs(i);
+			for (c=0;c<3;c++) {
+				stack[(i+radius)*3+c]=p[c];
+				sum[c]+=p[c]*rbs;
+				if (i>0)
+					insum[c]+=p[c];
+				else
+					outsum[c]+=p[c];
+			}
+		}
+		sp=radius;
+		for (x=rp->x;x<rp->x2;x++) {
+			//In place: the stack already holds everything left of x, and reads only happen ahead of x
+			for (c=0;c<3;c++)
+				row[x*4+c]=STACKBLUR_NORM(rp,sum[c]);
+			s=sp+radius+1;
+			if (s>=div)
+				s-=div;
+			p=row+rp->vminx[x]*4;
+			if (++sp==div)
+				sp=0;
+			for (c=0;c<3;c++) {
+				sum[c]-=outsum[c];
+				outsum[c]-=stack[s*3+c];
+				stack[s*3+c]=p[c];
+				insum[c]+=p[c];
+				sum[c]+=insum[c];
+				outsum[c]+=stack[sp*3+c];
+				insum[c]-=stack[sp*3+c];
+			}
+		}
+	}
+	return NULL;
+}
+
+//Vertical pass over a block of adjacent columns (rp->x..rp->x2, at most STACKBLUR_MAXVBLOCK). It walks the block row by row,
+//so every row step reads one contiguous run of pixels instead of jumping a whole row for each single column. The stacks
+//of a block take at most STACKBLUR_VSTATE bytes, or 8 columns' worth at large radii, see stackblur_vblock().
+static STACKBLUR_INLINE void *VStackBlock(StackBlurRenderingParams *rp,int radius) {
+	int n=rp->x2-rp->x;
+	int div=radius+radius+1;
+	int r1=radius+1;
+	int hm=rp->H-rp->y-1;
+	int stack[div*3*n];
+	int sum[3*STACKBLUR_MAXVBLOCK],insum[3*STACKBLUR_MAXVBLOCK],outsum[3*STACKBLUR_MAXVBLOCK];
+	int *in,*out;
+	int c,i,j,k,y,yi,yp,sp,s,p,rbs,v;
+
+	memset(sum,0,sizeof(sum));
+	memset(insum,0,sizeof(insum));
+	memset(outsum,0,sizeof(outsum));
+	yp=(rp->y-radius)*rp->w;
+	for (i=-radius;i<=radius;i++) {
+		yi=MAX(0,yp)+rp->x;
+		rbs=r1-abs(i);
+		for (c=0;c<3;c++) {
+			for (j=0;j<n;j++) {
+				k=c*n+j;
+				v=rp->pix[(yi+j)*4+c];
+				stack[(i+radius)*3*n+k]=v;
+				sum[k]+=v*rbs;
+				if (i>0)
+					insum[k]+=v;
+				else
+					outsum[k]+=v;
+			}
+		}
+		if (i<hm)
+			yp+=rp->w;
+	}
+	yi=rp->y*rp->w+rp->x;
+	sp=radius;
+	for (y=rp->y;y<rp->y2;y++) {
+		for (j=0;j<n;j++) {
+			p=(yi+j)*4;
+			rp->pix[p]=STACKBLUR_NORM(rp,sum[j]);
+			rp->pix[p+1]=STACKBLUR_NORM(rp,sum[n+j]);
+			rp->pix[p+2]=STACKBLUR_NORM(rp,sum[2*n+j]);
+			rp->pix[p+3]=0xff;
+		}
+		s=sp+radius+1;
+		if (s>=div)
+			s-=div;
+		p=rp->x+rp->vminy[y];
+		if (++sp==div)
+			sp=0;
+		in=stack+s*3*n;
+		out=stack+sp*3*n;
+		for (c=0;c<3;c++) {
+			for (j=0;j<n;j++) {
+				k=c*n+j;
+				sum[k]-=outsum[k];
+				outsum[k]-=in[k];
+				in[k]=rp->pix[(p+j)*4+c];
+				insum[k]+=in[k];
+				sum[k]+=insum[k];
+				outsum[k]+=out[k];
+				insum[k]-=out[k];
+			}
+		}
+		yi+=rp->w;
+	}
+	return NULL;
+}
+
+static void *HStackRenderingRows(void *arg) {
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
+	return HStackRows(rp,rp->radius);
+}
+
+void *VStackRenderingBlock(void *arg) {
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
+	return VStackBlock(rp,rp->radius);
+}
+
+#define STACKBLUR_RADIUS(r) \
+static void *HStackRenderingRows##r(void *arg) { return HStackRows((StackBlurRenderingParams*)arg,r); } \
+static void *VStackRenderingBlock##r(void *arg) { return VStackBlock((StackBlurRenderingParams*)arg,r); }
+STACKBLUR_RADII
+#undef STACKBLUR_RADIUS
+
+#define STACKBLUR_RADIUS(r) {r,HStackRenderingRows##r,VStackRenderingBlock##r},
+static const StackBlurRadius scalarradii[]={
+	STACKBLUR_RADII
+	{0,NULL,NULL},
+};
+#undef STACKBLUR_RADIUS
+
+//Block width for the vertical pass: a multiple of 8 columns, as wide as possible while the stacks of
+//all its columns (3 channels, div entries each) still fit in STACKBLUR_VSTATE bytes
+int stackblur_vblock(int radius) {
+	int n=STACKBLUR_VSTATE/(3*(radius+radius+1)*(int)sizeof(int));
+	return MIN(MAX(n&~7,8),STACKBLUR_MAXVBLOCK);
+}
+
+static const StackBlurKernel scalarkernel={"scalar",HStackRenderingRows,VStackRenderingBlock,NULL,scalarradii};
+static const StackBlurKernel *kernel;
+
+int stackblur_setkernel(const char *name) {
+	const StackBlurKernel *k;
+	if (name && !strcmp(name,scalarkernel.name)) {
+		kernel=&scalarkernel;
+		return 0;
+	}
+	for (k=stackblur_simd;k->name;k++) {
+		if ((!name || !strcmp(name,k->name)) && k->supported()) {
+			kernel=k;
+			return 0;
+		}
+	}
+	if (name)
+		return -1;
+	kernel=&scalarkernel;
+	return 0;
+}
+
+const char *stackblur_kernelname(void) {
+	if (!kernel)
+		stackblur_setkernel(NULL);
+	return kernel->name;
+}
+
+typedef struct {
+	StackBlurRenderingParams rp;
+	void *(*hpass)(void *arg);
+	void *(*vpass)(void *arg);
+	int htiles;
+	int vtiles;
+	int vcols;
+	int hnext;
+	int vnext;
+	int screen;
+	size_t stacklen;	//ints of rp.stack per worker
+} StackBlurJobParams;
+
+//Runs on every pool worker. Both passes are cut into many small tiles handed out through an atomic counter, so a core that is
+//busy elsewhere only delays the tiles it actually took: row chunks for the horizontal pass, cache-sized column blocks for the
+//vertical one.
+static void StackBlurJob(void *arg, unsigned int id, unsigned int n) {
+	StackBlurJobParams *job=(StackBlurJobParams*)arg;
+	StackBlurRenderingParams rp=job->rp;
+	int t;
+	uint64_t start=trace_now();
+	if (rp.stack)
+		rp.stack+=id*job->stacklen;
+	while ((t=__atomic_fetch_add(&job->hnext,1,__ATOMIC_RELAXED))<job->htiles) {
+		rp.y=job->rp.y+t*STACKBLUR_TILEROWS;
+		rp.y2=MIN(rp.y+STACKBLUR_TILEROWS,job->rp.y2);
+#ifdef DEBUG
+		fprintf(stdout,"HTile: %i Thread: %i y: %i y2: %i\n",t,id,rp.y,rp.y2);
+#endif
+		job->hpass(&rp);
 	}
+	trace_add("hpass",job->screen,TRACE_WORKER+id,start);
+	pool_barrier();
+	start=trace_now();
+	rp.y=job->rp.y;
+	rp.y2=job->rp.y2;
+	while ((t=__atomic_fetch_add(&job->vnext,1,__ATOMIC_RELAXED))<job->vtiles) {
+		rp.x=job->rp.x+t*job->vcols;
+		rp.x2=MIN(rp.x+job->vcols,job->rp.x2);
+#ifdef DEBUG
+		fprintf(stdout,"VTile: %i Thread: %i x: %i x2: %i\n",t,id,rp.x,rp.x2);
+#endif
+		job->vpass(&rp);
+	}
+	trace_add("vpass",job->screen,TRACE_WORKER+id,start);
+}
+
+void stackblur(XImage *image,int x, int y,int w,int h,int radius) {
+	int fmt=blur_format(image);
+	if (radius<1 || fmt<0)
+		return;
+	radius=MIN(radius,STACKBLUR_MAXRADIUS);
+	//The passes address the region as a packed w x h image starting at pix. Full-width bands are blurred where they
+	//are; narrower regions, such as one monitor of several, are copied out row by row and back afterwards.
+	const StackBlurFormat *f=&stackblur_formats[fmt];
+	const StackBlurKernel *k;
+	const StackBlurRadius *r;
+	int bpp=f->bpp;
+	int vcols=stackblur_vblock(radius);
+	int inplace=x==0 && w*bpp==image->bytes_per_line;
+	char *pix,*buf=NULL;
+	int i;
 	int *vminx=malloc(w*sizeof(int));
+	int *vminy=malloc(h*sizeof(int));
+	//The format passes get their stacks here, one per worker, rather than each tile allocating its own
+	size_t stacklen=f->kernel.hpass ? (size_t)3*(radius+radius+1)*vcols : 0;
+	int *stacks=stacklen ? malloc(pool_size()*stacklen*sizeof(int)) : NULL;
+	if (!inplace)
+		buf=malloc((size_t)w*h*bpp);
+	if (!vminx || !vminy || (stacklen && !stacks) || (!inplace && !buf)) {
+		//Half a blur would leave the rest readable, so the region is blanked, as blur() does with formats it cannot blur
+		fprintf(stderr,"slock: out of memory, blanking a %dx%d area instead of blurring it\n",w,h);
+		for (i=0;i<h;i++)
+			memset(image->data+(size_t)(y+i)*image->bytes_per_line+x*bpp,0,(size_t)w*bpp);
+		free(vminx);
+		free(vminy);
+		free(stacks);
+		free(buf);
+		return;
+	}
+	if (inplace) {
+		pix=image->data+(size_t)y*image->bytes_per_line;
+	} else {
+		for (i=0;i<h;i++)
+			memcpy(buf+(size_t)i*w*bpp,image->data+(size_t)(y+i)*image->bytes_per_line+x*bpp,w*bpp);
+		pix=buf;
+	}
+
 	for (i=0;i<w;i++)
 		vminx[i]=MIN(i+radius+1,w-1);
-	int *vminy=malloc(h*sizeof(int));
 	for (i=0;i<h;i++)
 		vminy[i]=MIN(i+radius+1,h-1)*w;
 
-	pthread_t *pthh=malloc(num_threads*sizeof(pthread_t));
-	StackBlurRenderingParams *rp=malloc(num_threads*sizeof(StackBlurRenderingParams));
-	int threadY=y;
-	int threadH=(h/num_threads);
- 	for (i=0;i<num_threads;i++) {
-		rp[i].pix=(unsigned char*)pix;
-		rp[i].x=x;
-		rp[i].w=w;
-		rp[i].y=threadY;
-		//Below "if" is to avoid vertical threads running on the same line when h/num_threads is not a round number i.e. 1080 lines / 16 threads = 67.5 lines!
-		if (i==num_threads-1)//last turn
-			rp[i].y2=y+h;
-		else
-			rp[i].y2=threadY+threadH;
- 		rp[i].H=h;
-		rp[i].wm=rp[i].w-1;
-		rp[i].wh=wh;
-		rp[i].r=r;
-		rp[i].g=g;
-		rp[i].b=b;
-		rp[i].dv=dv;
-		rp[i].radius=radius;
-		rp[i].vminx=vminx;
-		rp[i].vminy=vminy;
-#ifdef DEBUG
-		fprintf(stdout,"HThread: %i X: %i Y: %i W: %i H: %i x: %i y: %i w: %i h: %i\n",i,x,y,w,h,rp[i].x,rp[i].y,rp[i].w,threadH);
-#endif
-		pthread_create(&pthh[i],NULL,HStackRenderingThread,(void*)&rp[i]);
-		threadY+=threadH;
+	StackBlurJobParams job;
+	job.rp.pix=(unsigned char*)pix;
+	job.rp.x=0;
+	job.rp.x2=w;
+	job.rp.w=w;
+	job.rp.y=0;
+	job.rp.y2=h;
+	job.rp.H=h;
+	job.rp.wm=w-1;
+	stackblur_normbits(radius,f->bits,&job.rp.mul,&job.rp.shr);
+	job.rp.radius=radius;
+	job.rp.vminx=vminx;
+	job.rp.vminy=vminy;
+	job.rp.stack=stacks;
+	job.stacklen=stacklen;
+	job.htiles=(h+STACKBLUR_TILEROWS-1)/STACKBLUR_TILEROWS;
+	job.vcols=vcols;
+	job.vtiles=(w+job.vcols-1)/job.vcols;
+	job.hnext=job.vnext=0;
+	job.screen=trace_screen();
+	if (!kernel)
+		stackblur_setkernel(NULL);
+	k=f->kernel.hpass ? &f->kernel : kernel;
+	job.hpass=k->hpass;
+	job.vpass=k->vpass;
+	for (r=k->radii;r && r->radius;r++) {
+		if (r->radius==radius) {
+			job.hpass=r->hpass;
+			job.vpass=r->vpass;
+			break;
+		}
 	}
-	for (i=0;i<num_threads;i++)
-		pthread_join(pthh[i],NULL);
-	pthread_t *pthv=malloc(num_threads*sizeof(pthread_t));
-	for (i=0;i<num_threads;i++) {
 #ifdef DEBUG
- 		fprintf(stdout,"VThread: %i X: %i Y: %i W: %i H: %i x: %i y: %i w: %i h: %i\n",i,x,y,w,h,rp[i].x,rp[i].y,rp[i].w,threadH);
+	fprintf(stdout,"X: %i Y: %i W: %i H: %i HTiles: %i VTiles: %i\n",x,y,w,h,job.htiles,job.vtiles);
 #endif
-		pthread_create(&pthv[i],NULL,VStackRenderingThread,(void*)&rp[i]);
-	}
-	for (i=0;i<num_threads;i++)
-		pthread_join(pthv[i],NULL);
+	pool_run(StackBlurJob,&job);
 	free(vminx);
 	free(vminy);
-	free(rp);
-	free(r);
-	free(g);
-	free(b);
-	free(dv);
-	free(pthh);
-	free(pthv);
-	rp=NULL;
-	dv=vminx=vminy=r=g=b=NULL;
-	pthh=pthv=NULL;
+	free(stacks);
+	vminx=vminy=NULL;
+	if (buf) {
+		for (i=0;i<h;i++)
+			memcpy(image->data+(size_t)(y+i)*image->bytes_per_line+x*bpp,buf+(size_t)i*w*bpp,w*bpp);
+		free(buf);
+	}
 #ifdef DEBUG
  	fprintf(stdout,"Done.\n");
 #endif
@@ -36,36 +36,103 @@
 //	 to go wrong. Thanks to Jeroen Schellekens for 
 //       finding it!
 
+#include <stdint.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/Xrandr.h>
+#include "util.h"
 
 typedef struct {
 	unsigned char *pix;
 	int x;
+	int x2;
 	int y;
 	int w;
 	int y2;
 	int H;
 	int wm;
-	int wh;
-	int *r;
-	int *g;
-	int *b;
-	int *dv;
+	unsigned int mul;
+	int shr;
 	int radius;
 	int *vminx;
 	int *vminy;
+	int *stack;	//scratch of the format passes, 3*(2*radius+1)*(x2-x) ints
 } StackBlurRenderingParams;
 
-#include <pthread.h>
+//Rows per horizontal tile
+#define STACKBLUR_TILEROWS 16
+//Vertical tiles are column blocks whose stacks take at most this many bytes, i.e. most of a 32K L1 data cache
+#define STACKBLUR_VSTATE 24576
+#define STACKBLUR_MAXVBLOCK 64
 
-#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
-#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+//Largest radius stackblur() honours; sums then stay below 2^24, which the SIMD kernels rely on
+#define STACKBLUR_MAXRADIUS 254
+
+//sum/divsum for a stack sum, see stackblur_norm()
+#define STACKBLUR_NORM(rp,sum) ((unsigned char)(((uint64_t)(unsigned int)(sum)*(rp)->mul)>>(rp)->shr))
+//The same for channels wider than 8 bits, see stackblur_normbits()
+#define STACKBLUR_NORM32(rp,sum) ((int)(((uint64_t)(unsigned int)(sum)*(rp)->mul)>>(rp)->shr))
+
+//For pass bodies that take the radius apart: each kernel built for one radius gets its own copy with the radius constant
+#if defined(__GNUC__)
+#define STACKBLUR_INLINE inline __attribute__((always_inline))
+#else
+#define STACKBLUR_INLINE inline
+#endif
 
 void *HStackRenderingThread(void *arg);
 
 void *VStackRenderingThread(void *arg);
 
-void stackblur(XImage *image,int x, int y,int w,int h,int radius, unsigned int num_threads);
+void *VStackRenderingBlock(void *arg);
+
+int stackblur_vblock(int radius);
+
+void stackblur_norm(int radius,unsigned int *mul,int *shr);
+
+//stackblur_norm() for channels of the given number of bits
+void stackblur_normbits(int radius,int bits,unsigned int *mul,int *shr);
+
+//The passes of a kernel built for one radius, whose stacks, loop bounds and divisor are then constants. The radii
+//are the ones config.h blurs with, which mkradii writes to stackblur_radii.h as
+//  #define STACKBLUR_RADII STACKBLUR_RADIUS(r1) STACKBLUR_RADIUS(r2) ...
+typedef struct {
+	int radius;
+	void *(*hpass)(void *arg);
+	void *(*vpass)(void *arg);
+} StackBlurRadius;
+
+//A pair of pass functions: hpass blurs rows rp->y..rp->y2, vpass columns rp->x..rp->x2. Both work in place on pix,
+//so the horizontal result is kept as packed 8 bit pixels and no intermediate buffer is needed. stackblur() runs the
+//passes from radii, terminated by radius 0, instead where one matches the radius; NULL if there are none.
+typedef struct {
+	const char *name;
+	void *(*hpass)(void *arg);
+	void *(*vpass)(void *arg);
+	int (*supported)(void);
+	const StackBlurRadius *radii;
+} StackBlurKernel;
+
+//SIMD kernels for this architecture, best first, terminated by a NULL name
+extern const StackBlurKernel stackblur_simd[];
+
+//Scalar passes for one pixel format, plus conversions of n pixels to and from the 0xffRRGGBB words of BLUR_8888 that
+//let the downscaled blur read and write the format in its scaling passes. All are generated from stackblur_fmt.h.
+typedef struct {
+	StackBlurKernel kernel;
+	int bpp;	//bytes per pixel
+	int bits;	//of the widest channel
+	void (*unpack)(uint32_t *d,const unsigned char *s,int n);
+	void (*pack)(unsigned char *d,const uint32_t *s,int n);
+} StackBlurFormat;
+
+//Indexed by blur_format(). The BLUR_8888 entry has no passes of its own, it runs the kernel picked above.
+extern const StackBlurFormat stackblur_formats[];
+
+void stackblur(XImage *image,int x, int y,int w,int h,int radius);
+
+//Forces a kernel by name ("scalar" for plain C), NULL picks the best one the CPU supports; -1 if unavailable
+int stackblur_setkernel(const char *name);
+
+const char *stackblur_kernelname(void);
 
 
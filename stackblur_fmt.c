@@ -0,0 +1,103 @@
+// Stack-blur for the pixel formats other than BLUR_8888, so that 16 and 30 bit visuals and servers that store
+// pixels MSB first are blurred as they come from XGetImage, with no conversion pass in front.
+//
+// Every format is an instance of stackblur_fmt.h. Its channels are read and written at their own width, 5, 6,
+// 8 or 10 bits, and summed in separate ints, so the passes are plain C rather than SIMD; BLUR_8888, the common
+// case, keeps the kernels of stackblur.c and stackblur_simd.c. Pad bits are set, as the 8888 kernels set alpha.
+
+#include "blur.h"
+#include "stackblur.h"
+#include <stdlib.h>
+#include <string.h>
+
+static inline unsigned int get16le(const unsigned char *p) { return p[0]|p[1]<<8; }
+static inline unsigned int get16be(const unsigned char *p) { return p[0]<<8|p[1]; }
+static inline unsigned int get32le(const unsigned char *p) { return p[0]|p[1]<<8|p[2]<<16|(unsigned int)p[3]<<24; }
+static inline unsigned int get32be(const unsigned char *p) { return (unsigned int)p[0]<<24|p[1]<<16|p[2]<<8|p[3]; }
+
+static inline void put16le(unsigned char *p,unsigned int v) { p[0]=v; p[1]=v>>8; }
+static inline void put16be(unsigned char *p,unsigned int v) { p[0]=v>>8; p[1]=v; }
+static inline void put32le(unsigned char *p,unsigned int v) { p[0]=v; p[1]=v>>8; p[2]=v>>16; p[3]=v>>24; }
+static inline void put32be(unsigned char *p,unsigned int v) { p[0]=v>>24; p[1]=v>>16; p[2]=v>>8; p[3]=v; }
+
+static inline void split565(unsigned int v,int *c) { c[0]=v>>11; c[1]=v>>5&0x3f; c[2]=v&0x1f; }
+static inline void split2101010(unsigned int v,int *c) { c[0]=v>>20&0x3ff; c[1]=v>>10&0x3ff; c[2]=v&0x3ff; }
+
+#define JOIN565(c) ((unsigned int)(c)[0]<<11|(c)[1]<<5|(c)[2])
+#define JOIN2101010(c) (3U<<30|(unsigned int)(c)[0]<<20|(c)[1]<<10|(c)[2])
+
+//Channels widened to 8 bits by repeating their top bits, and narrowed by dropping the low ones
+#define WORD565(c) (0xff000000|((c)[0]<<3|(c)[0]>>2)<<16|((c)[1]<<2|(c)[1]>>4)<<8|((c)[2]<<3|(c)[2]>>2))
+#define SPLIT565(v,c) ((c)[0]=(v)>>19&0x1f,(c)[1]=(v)>>10&0x3f,(c)[2]=(v)>>3&0x1f)
+#define WORD2101010(c) (0xff000000|(uint32_t)((c)[0]>>2)<<16|((c)[1]>>2)<<8|(c)[2]>>2)
+#define SPLIT2101010(v,c) ((c)[0]=((v)>>16&0xff)<<2|((v)>>22&3),(c)[1]=((v)>>8&0xff)<<2|((v)>>14&3),\
+                           (c)[2]=((v)&0xff)<<2|((v)>>6&3))
+
+#define FMT x888
+#define BPP 4
+#define LOAD(p,c) ((c)[0]=(p)[1],(c)[1]=(p)[2],(c)[2]=(p)[3])
+#define STORE(p,c) ((p)[0]=0xff,(p)[1]=(c)[0],(p)[2]=(c)[1],(p)[3]=(c)[2])
+#define TOWORD(c) (0xff000000|(uint32_t)(c)[0]<<16|(c)[1]<<8|(c)[2])
+#define FROMWORD(v,c) ((c)[0]=(v)>>16&0xff,(c)[1]=(v)>>8&0xff,(c)[2]=(v)&0xff)
+#include "stackblur_fmt.h"
+#undef FMT
+#undef BPP
+#undef LOAD
+#undef STORE
+#undef TOWORD
+#undef FROMWORD
+
+#define FMT rgb565le
+#define BPP 2
+#define LOAD(p,c) split565(get16le(p),c)
+#define STORE(p,c) put16le(p,JOIN565(c))
+#define TOWORD(c) WORD565(c)
+#define FROMWORD(v,c) SPLIT565(v,c)
+#include "stackblur_fmt.h"
+#undef FMT
+#undef LOAD
+#undef STORE
+
+#define FMT rgb565be
+#define LOAD(p,c) split565(get16be(p),c)
+#define STORE(p,c) put16be(p,JOIN565(c))
+#include "stackblur_fmt.h"
+#undef FMT
+#undef BPP
+#undef LOAD
+#undef STORE
+#undef TOWORD
+#undef FROMWORD
+
+#define FMT rgb2101010le
+#define BPP 4
+#define LOAD(p,c) split2101010(get32le(p),c)
+#define STORE(p,c) put32le(p,JOIN2101010(c))
+#define TOWORD(c) WORD2101010(c)
+#define FROMWORD(v,c) SPLIT2101010(v,c)
+#include "stackblur_fmt.h"
+#undef FMT
+#undef LOAD
+#undef STORE
+
+#define FMT rgb2101010be
+#define LOAD(p,c) split2101010(get32be(p),c)
+#define STORE(p,c) put32be(p,JOIN2101010(c))
+#include "stackblur_fmt.h"
+#undef FMT
+#undef BPP
+#undef LOAD
+#undef STORE
+#undef TOWORD
+#undef FROMWORD
+
+#define FORMAT(f,name,bpp,bits) {{name,f##_hpass,f##_vpass,NULL,NULL},bpp,bits,f##_unpack,f##_pack}
+
+const StackBlurFormat stackblur_formats[BLUR_NFORMATS]={
+	[BLUR_8888]={{"8888",NULL,NULL,NULL,NULL},4,8,NULL,NULL},
+	[BLUR_X888]=FORMAT(x888,"x888",4,8),
+	[BLUR_565LE]=FORMAT(rgb565le,"565le",2,6),
+	[BLUR_565BE]=FORMAT(rgb565be,"565be",2,6),
+	[BLUR_2101010LE]=FORMAT(rgb2101010le,"2101010le",4,10),
+	[BLUR_2101010BE]=FORMAT(rgb2101010be,"2101010be",4,10),
+};
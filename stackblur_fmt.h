@@ -0,0 +1,155 @@
+// Stack-blur passes and row conversions for one pixel format, included by stackblur_fmt.c once per format with
+//   FMT              prefix of the generated names
+//   BPP              bytes per pixel
+//   LOAD(p,c)        the channels of the pixel at p into c[0..2]
+//   STORE(p,c)       c[0..2] into the pixel at p, pad bits set
+//   TOWORD(c)        c[0..2] as a 0xffRRGGBB word, c[0] in the top channel
+//   FROMWORD(v,c)    the reverse
+// The passes are HStackRenderingThread and VStackRenderingBlock with the channels kept apart, so they give the
+// same result as those would on the channels widened to 8 bits, only at the format's own precision. Their stacks
+// are rp->stack, which stackblur() allocates once per worker for the whole job.
+
+#define FN2(f,n) f##_##n
+#define FN1(f,n) FN2(f,n)
+#define FN(n) FN1(FMT,n)
+
+static void *FN(hpass)(void *arg) {
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
+	int div=rp->radius+rp->radius+1;
+	int r1=rp->radius+1;
+	int *stack=rp->stack;
+	int sum[3],insum[3],outsum[3],c[3];
+	unsigned char *row;
+	int x,y,i,k,sp,s,rbs;
+
+	for (y=rp->y;y<rp->y2;y++) {
+		row=rp->pix+(size_t)y*rp->w*BPP;
+		for (k=0;k<3;k++)
+			sum[k]=insum[k]=outsum[k]=0;
+		for (i=-rp->radius;i<=rp->radius;i++) {
+			LOAD(row+MIN(rp->wm,MAX(i,0))*BPP,c);
+			rbs=r1-abs(i);
+			for (k=0;k<3;k++) {
+				stack[(i+rp->radius)*3+k]=c[k];
+				sum[k]+=c[k]*rbs;
+				if (i>0)
+					insum[k]+=c[k];
+				else
+					outsum[k]+=c[k];
+			}
+		}
+		sp=rp->radius;
+		for (x=rp->x;x<rp->x2;x++) {
+			//In place, as in HStackRenderingThread: reads only happen ahead of x
+			for (k=0;k<3;k++)
+				c[k]=STACKBLUR_NORM32(rp,sum[k]);
+			STORE(row+x*BPP,c);
+			s=sp+rp->radius+1;
+			if (s>=div)
+				s-=div;
+			LOAD(row+rp->vminx[x]*BPP,c);
+			if (++sp==div)
+				sp=0;
+			for (k=0;k<3;k++) {
+				sum[k]-=outsum[k];
+				outsum[k]-=stack[s*3+k];
+				stack[s*3+k]=c[k];
+				insum[k]+=c[k];
+				sum[k]+=insum[k];
+				outsum[k]+=stack[sp*3+k];
+				insum[k]-=stack[sp*3+k];
+			}
+		}
+	}
+	return NULL;
+}
+
+static void *FN(vpass)(void *arg) {
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
+	int n=rp->x2-rp->x;
+	int div=rp->radius+rp->radius+1;
+	int r1=rp->radius+1;
+	int hm=rp->H-rp->y-1;
+	size_t stride=(size_t)rp->w*BPP;
+	int *stack=rp->stack;
+	int sum[3*STACKBLUR_MAXVBLOCK],insum[3*STACKBLUR_MAXVBLOCK],outsum[3*STACKBLUR_MAXVBLOCK];
+	int *in,*out,c[3];
+	unsigned char *row;
+	int i,j,k,y,yp,sp,s,rbs;
+
+	memset(sum,0,sizeof(sum));
+	memset(insum,0,sizeof(insum));
+	memset(outsum,0,sizeof(outsum));
+	yp=rp->y-rp->radius;
+	for (i=-rp->radius;i<=rp->radius;i++) {
+		row=rp->pix+MAX(0,yp)*stride+rp->x*BPP;
+		rbs=r1-abs(i);
+		for (j=0;j<n;j++) {
+			LOAD(row+j*BPP,c);
+			for (k=0;k<3;k++) {
+				stack[(i+rp->radius)*3*n+k*n+j]=c[k];
+				sum[k*n+j]+=c[k]*rbs;
+				if (i>0)
+					insum[k*n+j]+=c[k];
+				else
+					outsum[k*n+j]+=c[k];
+			}
+		}
+		if (i<hm)
+			yp++;
+	}
+	sp=rp->radius;
+	for (y=rp->y;y<rp->y2;y++) {
+		row=rp->pix+y*stride+rp->x*BPP;
+		for (j=0;j<n;j++) {
+			for (k=0;k<3;k++)
+				c[k]=STACKBLUR_NORM32(rp,sum[k*n+j]);
+			STORE(row+j*BPP,c);
+		}
+		s=sp+rp->radius+1;
+		if (s>=div)
+			s-=div;
+		//vminy holds pixel offsets of packed 4 byte rows, w per row
+		row=rp->pix+rp->vminy[y]/rp->w*stride+rp->x*BPP;
+		if (++sp==div)
+			sp=0;
+		in=stack+s*3*n;
+		out=stack+sp*3*n;
+		for (j=0;j<n;j++) {
+			LOAD(row+j*BPP,c);
+			for (k=0;k<3;k++) {
+				i=k*n+j;
+				sum[i]-=outsum[i];
+				outsum[i]-=in[i];
+				in[i]=c[k];
+				insum[i]+=in[i];
+				sum[i]+=insum[i];
+				outsum[i]+=out[i];
+				insum[i]-=out[i];
+			}
+		}
+	}
+	return NULL;
+}
+
+static void FN(unpack)(uint32_t *d,const unsigned char *s,int n) {
+	int c[3],x;
+
+	for (x=0;x<n;x++,s+=BPP) {
+		LOAD(s,c);
+		d[x]=TOWORD(c);
+	}
+}
+
+static void FN(pack)(unsigned char *d,const uint32_t *s,int n) {
+	int c[3],x;
+
+	for (x=0;x<n;x++,d+=BPP) {
+		FROMWORD(s[x],c);
+		STORE(d,c);
+	}
+}
+
+#undef FN
+#undef FN1
+#undef FN2
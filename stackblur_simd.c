@@ -0,0 +1,554 @@
+// Vectorized stack-blur kernels.
+//
+// They compute exactly what HStackRenderingThread/VStackRenderingThread
+// compute, which stay in stackblur.c as the reference and as the fallback
+// on machines without any of the instruction sets below.
+//
+// Like them, they blur in place: the horizontal pass writes packed pixels
+// back into the image and the vertical pass reads them from there.
+//
+// The horizontal pass keeps one pixel per vector, its channels side by
+// side in 32 bit lanes, so a single add updates all three running sums.
+// The vertical pass puts adjacent columns side by side instead: 8 of them
+// with AVX2, 4 with SSE4.1 and NEON, and walks a whole cache block of such
+// vectors row by row (see stackblur_vblock()).
+//
+// Where the scalar kernels divide with a 64 bit multiply and shift, these
+// multiply with 1/divsum in single precision and then fix the quotient up
+// by one where rounding went wrong.  Sums stay below 2^24, so the estimate
+// is never off by more than one and the result is exactly sum/divsum.
+//
+// The ring index wraps with a compare instead of %div.
+//
+// Each pass body takes the radius as an argument and is inlined into
+// one generic pass and one pass per radius in stackblur_radii.h, which
+// stackblur() picks when the radius matches.
+
+#include "stackblur.h"
+#include "stackblur_radii.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+#define SSE41 __attribute__((target("sse4.1")))
+#define AVX2 __attribute__((target("avx2")))
+
+static SSE41 inline __m128i sse41_loadpx(const unsigned char *p) {
+	int v;
+	memcpy(&v,p,4);
+	return _mm_cvtepu8_epi32(_mm_cvtsi32_si128(v));
+}
+
+static SSE41 inline __m128i sse41_div(__m128i sum,__m128 inv,__m128i d,__m128i dm1) {
+	__m128i q=_mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum),inv));
+	__m128i rem=_mm_sub_epi32(sum,_mm_mullo_epi32(q,d));
+	__m128i lo=_mm_cmpgt_epi32(_mm_setzero_si128(),rem);
+	q=_mm_add_epi32(q,lo);
+	rem=_mm_add_epi32(rem,_mm_and_si128(lo,d));
+	return _mm_sub_epi32(q,_mm_cmpgt_epi32(rem,dm1));
+}
+
+static SSE41 STACKBLUR_INLINE void *sse41_hrows(StackBlurRenderingParams *rp,int radius) {
+	int div=radius+radius+1;
+	int divsum=(div+1)>>1;
+	divsum*=divsum;
+	int r1=radius+1;
+	int x,y,i,yi,yw,sp,s,v;
+	__m128i stack[div];
+	__m128i sum,insum,outsum,px,q;
+	__m128 inv=_mm_set1_ps(1.0f/divsum);
+	__m128i d=_mm_set1_epi32(divsum),dm1=_mm_set1_epi32(divsum-1);
+
+	yw=yi=rp->y*rp->w;
+	for (y=rp->y;y<rp->y2;y++) {
+		sum=insum=outsum=_mm_setzero_si128();
+		for (i=-radius;i<=radius;i++) {
+			px=sse41_loadpx(rp->pix+(yi+MIN(rp->wm,MAX(i,0)))*4);
+			stack[i+radius]=px;
+			sum=_mm_add_epi32(sum,_mm_mullo_epi32(px,_mm_set1_epi32(r1-abs(i))));
+			if (i>0)
+				insum=_mm_add_epi32(insum,px);
+			else
+				outsum=_mm_add_epi32(outsum,px);
+		}
+		sp=radius;
+		for (x=rp->x;x<rp->x2;x++) {
+			q=sse41_div(sum,inv,d,dm1);
+			q=_mm_packus_epi32(q,q);
+			px=_mm_packus_epi16(q,q);
+			v=_mm_cvtsi128_si32(px);
+			memcpy(rp->pix+yi*4,&v,4);
+
+			sum=_mm_sub_epi32(sum,outsum);
+			s=sp+radius+1;
+			if (s>=div)
+				s-=div;
+			outsum=_mm_sub_epi32(outsum,stack[s]);
+			stack[s]=sse41_loadpx(rp->pix+(yw+rp->vminx[x])*4);
+			insum=_mm_add_epi32(insum,stack[s]);
+			sum=_mm_add_epi32(sum,insum);
+			if (++sp==div)
+				sp=0;
+			outsum=_mm_add_epi32(outsum,stack[sp]);
+			insum=_mm_sub_epi32(insum,stack[sp]);
+			yi++;
+		}
+		yw+=rp->w;
+	}
+	return NULL;
+}
+
+// splits 4 packed pixels into one vector per channel
+static SSE41 inline void sse41_unpack(const unsigned char *p,__m128i ch[3]) {
+	__m128i px=_mm_loadu_si128((const __m128i*)p),m=_mm_set1_epi32(0xff);
+	ch[0]=_mm_and_si128(px,m);
+	ch[1]=_mm_and_si128(_mm_srli_epi32(px,8),m);
+	ch[2]=_mm_and_si128(_mm_srli_epi32(px,16),m);
+}
+
+// nv groups of 4 columns starting at x, walked row by row together
+static SSE41 STACKBLUR_INLINE void sse41_vcols(StackBlurRenderingParams *rp,int radius,int x,int nv) {
+	int div=radius+radius+1;
+	int divsum=(div+1)>>1;
+	divsum*=divsum;
+	int r1=radius+1;
+	int hm=rp->H-rp->y-1;
+	int c,i,j,k,y,yi,yp,sp,s,p;
+	__m128i stack[div*3*nv];
+	__m128i sum[3*nv],insum[3*nv],outsum[3*nv],v,q[3],ch[3],*in,*out;
+	__m128 inv=_mm_set1_ps(1.0f/divsum);
+	__m128i d=_mm_set1_epi32(divsum),dm1=_mm_set1_epi32(divsum-1);
+	__m128i alpha=_mm_set1_epi32(0xff000000);
+
+	for (k=0;k<3*nv;k++)
+		sum[k]=insum[k]=outsum[k]=_mm_setzero_si128();
+	yp=(rp->y-radius)*rp->w;
+	for (i=-radius;i<=radius;i++) {
+		yi=MAX(0,yp)+x;
+		for (j=0;j<nv;j++) {
+			sse41_unpack(rp->pix+(yi+4*j)*4,ch);
+			for (c=0;c<3;c++) {
+				k=c*nv+j;
+				v=ch[c];
+				stack[(i+radius)*3*nv+k]=v;
+				sum[k]=_mm_add_epi32(sum[k],_mm_mullo_epi32(v,_mm_set1_epi32(r1-abs(i))));
+				if (i>0)
+					insum[k]=_mm_add_epi32(insum[k],v);
+				else
+					outsum[k]=_mm_add_epi32(outsum[k],v);
+			}
+		}
+		if (i<hm)
+			yp+=rp->w;
+	}
+	yi=rp->y*rp->w+x;
+	sp=radius;
+	for (y=rp->y;y<rp->y2;y++) {
+		for (j=0;j<nv;j++) {
+			for (c=0;c<3;c++)
+				q[c]=sse41_div(sum[c*nv+j],inv,d,dm1);
+			v=_mm_or_si128(_mm_or_si128(q[0],_mm_slli_epi32(q[1],8)),
+			               _mm_or_si128(_mm_slli_epi32(q[2],16),alpha));
+			_mm_storeu_si128((__m128i*)(rp->pix+(yi+4*j)*4),v);
+		}
+
+		s=sp+radius+1;
+		if (s>=div)
+			s-=div;
+		p=x+rp->vminy[y];
+		if (++sp==div)
+			sp=0;
+		in=stack+s*3*nv;
+		out=stack+sp*3*nv;
+		for (j=0;j<nv;j++) {
+			sse41_unpack(rp->pix+(p+4*j)*4,ch);
+			for (c=0;c<3;c++) {
+				k=c*nv+j;
+				sum[k]=_mm_sub_epi32(sum[k],outsum[k]);
+				outsum[k]=_mm_sub_epi32(outsum[k],in[k]);
+				in[k]=ch[c];
+				insum[k]=_mm_add_epi32(insum[k],in[k]);
+				sum[k]=_mm_add_epi32(sum[k],insum[k]);
+				outsum[k]=_mm_add_epi32(outsum[k],out[k]);
+				insum[k]=_mm_sub_epi32(insum[k],out[k]);
+			}
+		}
+		yi+=rp->w;
+	}
+}
+
+static SSE41 STACKBLUR_INLINE void *sse41_vblock(StackBlurRenderingParams *rp,int radius) {
+	StackBlurRenderingParams tail;
+	int x=rp->x,nv=(rp->x2-rp->x)/4;
+	if (nv) {
+		sse41_vcols(rp,radius,x,nv);
+		x+=4*nv;
+	}
+	if (x<rp->x2) {
+		tail=*rp;
+		tail.x=x;
+		VStackRenderingBlock(&tail);
+	}
+	return NULL;
+}
+
+static SSE41 void *sse41_hpass(void *arg) {
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
+	return sse41_hrows(rp,rp->radius);
+}
+
+static SSE41 void *sse41_vpass(void *arg) {
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
+	return sse41_vblock(rp,rp->radius);
+}
+
+static AVX2 inline __m256i avx2_div(__m256i sum,__m256 inv,__m256i d,__m256i dm1) {
+	__m256i q=_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(sum),inv));
+	__m256i rem=_mm256_sub_epi32(sum,_mm256_mullo_epi32(q,d));
+	__m256i lo=_mm256_cmpgt_epi32(_mm256_setzero_si256(),rem);
+	q=_mm256_add_epi32(q,lo);
+	rem=_mm256_add_epi32(rem,_mm256_and_si256(lo,d));
+	return _mm256_sub_epi32(q,_mm256_cmpgt_epi32(rem,dm1));
+}
+
+static AVX2 inline void avx2_unpack(const unsigned char *p,__m256i ch[3]) {
+	__m256i px=_mm256_loadu_si256((const __m256i*)p),m=_mm256_set1_epi32(0xff);
+	ch[0]=_mm256_and_si256(px,m);
+	ch[1]=_mm256_and_si256(_mm256_srli_epi32(px,8),m);
+	ch[2]=_mm256_and_si256(_mm256_srli_epi32(px,16),m);
+}
+
+// nv groups of 8 columns starting at x, walked row by row together
+static AVX2 STACKBLUR_INLINE void avx2_vcols(StackBlurRenderingParams *rp,int radius,int x,int nv) {
+	int div=radius+radius+1;
+	int divsum=(div+1)>>1;
+	divsum*=divsum;
+	int r1=radius+1;
+	int hm=rp->H-rp->y-1;
+	int c,i,j,k,y,yi,yp,sp,s,p;
+	__m256i stack[div*3*nv];
+	__m256i sum[3*nv],insum[3*nv],outsum[3*nv],v,q[3],ch[3],*in,*out;
+	__m256 inv=_mm256_set1_ps(1.0f/divsum);
+	__m256i d=_mm256_set1_epi32(divsum),dm1=_mm256_set1_epi32(divsum-1);
+	__m256i alpha=_mm256_set1_epi32(0xff000000);
+
+	for (k=0;k<3*nv;k++)
+		sum[k]=insum[k]=outsum[k]=_mm256_setzero_si256();
+	yp=(rp->y-radius)*rp->w;
+	for (i=-radius;i<=radius;i++) {
+		yi=MAX(0,yp)+x;
+		for (j=0;j<nv;j++) {
+			avx2_unpack(rp->pix+(yi+8*j)*4,ch);
+			for (c=0;c<3;c++) {
+				k=c*nv+j;
+				v=ch[c];
+				stack[(i+radius)*3*nv+k]=v;
+				sum[k]=_mm256_add_epi32(sum[k],_mm256_mullo_epi32(v,_mm256_set1_epi32(r1-abs(i))));
+				if (i>0)
+					insum[k]=_mm256_add_epi32(insum[k],v);
+				else
+					outsum[k]=_mm256_add_epi32(outsum[k],v);
+			}
+		}
+		if (i<hm)
+			yp+=rp->w;
+	}
+	yi=rp->y*rp->w+x;
+	sp=radius;
+	for (y=rp->y;y<rp->y2;y++) {
+		for (j=0;j<nv;j++) {
+			for (c=0;c<3;c++)
+				q[c]=avx2_div(sum[c*nv+j],inv,d,dm1);
+			v=_mm256_or_si256(_mm256_or_si256(q[0],_mm256_slli_epi32(q[1],8)),
+			                  _mm256_or_si256(_mm256_slli_epi32(q[2],16),alpha));
+			_mm256_storeu_si256((__m256i*)(rp->pix+(yi+8*j)*4),v);
+		}
+
+		s=sp+radius+1;
+		if (s>=div)
+			s-=div;
+		p=x+rp->vminy[y];
+		if (++sp==div)
+			sp=0;
+		in=stack+s*3*nv;
+		out=stack+sp*3*nv;
+		for (j=0;j<nv;j++) {
+			avx2_unpack(rp->pix+(p+8*j)*4,ch);
+			for (c=0;c<3;c++) {
+				k=c*nv+j;
+				sum[k]=_mm256_sub_epi32(sum[k],outsum[k]);
+				outsum[k]=_mm256_sub_epi32(outsum[k],in[k]);
+				in[k]=ch[c];
+				insum[k]=_mm256_add_epi32(insum[k],in[k]);
+				sum[k]=_mm256_add_epi32(sum[k],insum[k]);
+				outsum[k]=_mm256_add_epi32(outsum[k],out[k]);
+				insum[k]=_mm256_sub_epi32(insum[k],out[k]);
+			}
+		}
+		yi+=rp->w;
+	}
+}
+
+static AVX2 STACKBLUR_INLINE void *avx2_vblock(StackBlurRenderingParams *rp,int radius) {
+	StackBlurRenderingParams tail;
+	int x=rp->x,nv=(rp->x2-rp->x)/8;
+	if (nv) {
+		avx2_vcols(rp,radius,x,nv);
+		x+=8*nv;
+	}
+	if (x<rp->x2) {
+		tail=*rp;
+		tail.x=x;
+		sse41_vpass(&tail);
+	}
+	return NULL;
+}
+
+static AVX2 void *avx2_vpass(void *arg) {
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
+	return avx2_vblock(rp,rp->radius);
+}
+
+static int avx2_supported(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+static int sse41_supported(void) {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.1");
+}
+
+#define STACKBLUR_RADIUS(r) \
+static SSE41 void *sse41_hpass##r(void *arg) { return sse41_hrows((StackBlurRenderingParams*)arg,r); } \
+static SSE41 void *sse41_vpass##r(void *arg) { return sse41_vblock((StackBlurRenderingParams*)arg,r); } \
+static AVX2 void *avx2_vpass##r(void *arg) { return avx2_vblock((StackBlurRenderingParams*)arg,r); }
+STACKBLUR_RADII
+#undef STACKBLUR_RADIUS
+
+// The AVX2 kernel shares the horizontal pass: one pixel only fills 3 of 8 lanes
+#define STACKBLUR_RADIUS(r) {r,sse41_hpass##r,avx2_vpass##r},
+static const StackBlurRadius avx2_radii[]={
+	STACKBLUR_RADII
+	{0,NULL,NULL},
+};
+#undef STACKBLUR_RADIUS
+
+#define STACKBLUR_RADIUS(r) {r,sse41_hpass##r,sse41_vpass##r},
+static const StackBlurRadius sse41_radii[]={
+	STACKBLUR_RADII
+	{0,NULL,NULL},
+};
+#undef STACKBLUR_RADIUS
+
+const StackBlurKernel stackblur_simd[]={
+	{"avx2",sse41_hpass,avx2_vpass,avx2_supported,avx2_radii},
+	{"sse4.1",sse41_hpass,sse41_vpass,sse41_supported,sse41_radii},
+	{NULL,NULL,NULL,NULL,NULL},
+};
+
+#elif defined(__GNUC__) && defined(__aarch64__)
+#include <arm_neon.h>
+
+static inline int32x4_t neon_loadpx(const unsigned char *p) {
+	uint8x8_t b;
+	uint32_t v;
+	memcpy(&v,p,4);
+	b=vreinterpret_u8_u32(vdup_n_u32(v));
+	return vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(vmovl_u8(b))));
+}
+
+static inline int32x4_t neon_div(int32x4_t sum,float32x4_t inv,int32x4_t d) {
+	int32x4_t q=vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(sum),inv));
+	int32x4_t rem=vsubq_s32(sum,vmulq_s32(q,d));
+	int32x4_t lo=vreinterpretq_s32_u32(vcltq_s32(rem,vdupq_n_s32(0)));
+	q=vaddq_s32(q,lo);
+	rem=vaddq_s32(rem,vandq_s32(lo,d));
+	return vsubq_s32(q,vreinterpretq_s32_u32(vcgeq_s32(rem,d)));
+}
+
+static STACKBLUR_INLINE void *neon_hrows(StackBlurRenderingParams *rp,int radius) {
+	int div=radius+radius+1;
+	int divsum=(div+1)>>1;
+	divsum*=divsum;
+	int r1=radius+1;
+	int x,y,i,yi,yw,sp,s;
+	int32x4_t stack[div];
+	int32x4_t sum,insum,outsum,px,q;
+	float32x4_t inv=vdupq_n_f32(1.0f/divsum);
+	int32x4_t d=vdupq_n_s32(divsum);
+
+	yw=yi=rp->y*rp->w;
+	for (y=rp->y;y<rp->y2;y++) {
+		sum=insum=outsum=vdupq_n_s32(0);
+		for (i=-radius;i<=radius;i++) {
+			px=neon_loadpx(rp->pix+(yi+MIN(rp->wm,MAX(i,0)))*4);
+			stack[i+radius]=px;
+			sum=vmlaq_n_s32(sum,px,r1-abs(i));
+			if (i>0)
+				insum=vaddq_s32(insum,px);
+			else
+				outsum=vaddq_s32(outsum,px);
+		}
+		sp=radius;
+		for (x=rp->x;x<rp->x2;x++) {
+			q=neon_div(sum,inv,d);
+			rp->pix[yi*4]=(unsigned char)vgetq_lane_s32(q,0);
+			rp->pix[yi*4+1]=(unsigned char)vgetq_lane_s32(q,1);
+			rp->pix[yi*4+2]=(unsigned char)vgetq_lane_s32(q,2);
+
+			sum=vsubq_s32(sum,outsum);
+			s=sp+radius+1;
+			if (s>=div)
+				s-=div;
+			outsum=vsubq_s32(outsum,stack[s]);
+			stack[s]=neon_loadpx(rp->pix+(yw+rp->vminx[x])*4);
+			insum=vaddq_s32(insum,stack[s]);
+			sum=vaddq_s32(sum,insum);
+			if (++sp==div)
+				sp=0;
+			outsum=vaddq_s32(outsum,stack[sp]);
+			insum=vsubq_s32(insum,stack[sp]);
+			yi++;
+		}
+		yw+=rp->w;
+	}
+	return NULL;
+}
+
+static inline void neon_unpack(const unsigned char *p,int32x4_t ch[3]) {
+	uint32x4_t px=vreinterpretq_u32_u8(vld1q_u8(p)),m=vdupq_n_u32(0xff);
+	ch[0]=vreinterpretq_s32_u32(vandq_u32(px,m));
+	ch[1]=vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(px,8),m));
+	ch[2]=vreinterpretq_s32_u32(vandq_u32(vshrq_n_u32(px,16),m));
+}
+
+// nv groups of 4 columns starting at x, walked row by row together
+static STACKBLUR_INLINE void neon_vcols(StackBlurRenderingParams *rp,int radius,int x,int nv) {
+	int div=radius+radius+1;
+	int divsum=(div+1)>>1;
+	divsum*=divsum;
+	int r1=radius+1;
+	int hm=rp->H-rp->y-1;
+	int c,i,j,k,y,yi,yp,sp,s,p;
+	int32x4_t stack[div*3*nv];
+	int32x4_t sum[3*nv],insum[3*nv],outsum[3*nv],v,q[3],ch[3],*in,*out;
+	float32x4_t inv=vdupq_n_f32(1.0f/divsum);
+	int32x4_t d=vdupq_n_s32(divsum);
+	uint32x4_t alpha=vdupq_n_u32(0xff000000);
+	uint32x4_t px;
+
+	for (k=0;k<3*nv;k++)
+		sum[k]=insum[k]=outsum[k]=vdupq_n_s32(0);
+	yp=(rp->y-radius)*rp->w;
+	for (i=-radius;i<=radius;i++) {
+		yi=MAX(0,yp)+x;
+		for (j=0;j<nv;j++) {
+			neon_unpack(rp->pix+(yi+4*j)*4,ch);
+			for (c=0;c<3;c++) {
+				k=c*nv+j;
+				v=ch[c];
+				stack[(i+radius)*3*nv+k]=v;
+				sum[k]=vmlaq_n_s32(sum[k],v,r1-abs(i));
+				if (i>0)
+					insum[k]=vaddq_s32(insum[k],v);
+				else
+					outsum[k]=vaddq_s32(outsum[k],v);
+			}
+		}
+		if (i<hm)
+			yp+=rp->w;
+	}
+	yi=rp->y*rp->w+x;
+	sp=radius;
+	for (y=rp->y;y<rp->y2;y++) {
+		for (j=0;j<nv;j++) {
+			for (c=0;c<3;c++)
+				q[c]=neon_div(sum[c*nv+j],inv,d);
+			px=vorrq_u32(vreinterpretq_u32_s32(q[0]),vshlq_n_u32(vreinterpretq_u32_s32(q[1]),8));
+			px=vorrq_u32(px,vshlq_n_u32(vreinterpretq_u32_s32(q[2]),16));
+			vst1q_u8(rp->pix+(yi+4*j)*4,vreinterpretq_u8_u32(vorrq_u32(px,alpha)));
+		}
+
+		s=sp+radius+1;
+		if (s>=div)
+			s-=div;
+		p=x+rp->vminy[y];
+		if (++sp==div)
+			sp=0;
+		in=stack+s*3*nv;
+		out=stack+sp*3*nv;
+		for (j=0;j<nv;j++) {
+			neon_unpack(rp->pix+(p+4*j)*4,ch);
+			for (c=0;c<3;c++) {
+				k=c*nv+j;
+				sum[k]=vsubq_s32(sum[k],outsum[k]);
+				outsum[k]=vsubq_s32(outsum[k],in[k]);
+				in[k]=ch[c];
+				insum[k]=vaddq_s32(insum[k],in[k]);
+				sum[k]=vaddq_s32(sum[k],insum[k]);
+				outsum[k]=vaddq_s32(outsum[k],out[k]);
+				insum[k]=vsubq_s32(insum[k],out[k]);
+			}
+		}
+		yi+=rp->w;
+	}
+}
+
+static STACKBLUR_INLINE void *neon_vblock(StackBlurRenderingParams *rp,int radius) {
+	StackBlurRenderingParams tail;
+	int x=rp->x,nv=(rp->x2-rp->x)/4;
+	if (nv) {
+		neon_vcols(rp,radius,x,nv);
+		x+=4*nv;
+	}
+	if (x<rp->x2) {
+		tail=*rp;
+		tail.x=x;
+		VStackRenderingBlock(&tail);
+	}
+	return NULL;
+}
+
+static void *neon_hpass(void *arg) {
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
+	return neon_hrows(rp,rp->radius);
+}
+
+static void *neon_vpass(void *arg) {
+	StackBlurRenderingParams *rp=(StackBlurRenderingParams*)arg;
+	return neon_vblock(rp,rp->radius);
+}
+
+// Advanced SIMD is mandatory on AArch64
+static int neon_supported(void) {
+	return 1;
+}
+
+#define STACKBLUR_RADIUS(r) \
+static void *neon_hpass##r(void *arg) { return neon_hrows((StackBlurRenderingParams*)arg,r); } \
+static void *neon_vpass##r(void *arg) { return neon_vblock((StackBlurRenderingParams*)arg,r); }
+STACKBLUR_RADII
+#undef STACKBLUR_RADIUS
+
+#define STACKBLUR_RADIUS(r) {r,neon_hpass##r,neon_vpass##r},
+static const StackBlurRadius neon_radii[]={
+	STACKBLUR_RADII
+	{0,NULL,NULL},
+};
+#undef STACKBLUR_RADIUS
+
+const StackBlurKernel stackblur_simd[]={
+	{"neon",neon_hpass,neon_vpass,neon_supported,neon_radii},
+	{NULL,NULL,NULL,NULL,NULL},
+};
+
+#else
+
+const StackBlurKernel stackblur_simd[]={
+	{NULL,NULL,NULL,NULL,NULL},
+};
+
+#endif
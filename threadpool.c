@@ -0,0 +1,200 @@
+/* See LICENSE file for license details. */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+/*
+ * Workers are started once and sleep on a condition variable between
+ * jobs.  pool_run() hands the same job to every worker and returns when
+ * all of them are done; pool_barrier() lets a job split itself into
+ * phases without going back to the caller.  Jobs from several callers
+ * take turns on the run mutex.
+ */
+static struct {
+	pthread_t *threads;
+	unsigned int n;
+	pthread_mutex_t run, lock;
+	pthread_cond_t work, done;
+	pthread_barrier_t barrier;
+	PoolFunc fn;
+	void *arg;
+	unsigned long gen;
+	unsigned int pending;
+	int quit;
+} pool;
+
+/*
+ * Fills cpus with the CPUs we are allowed to run on.  With physical set,
+ * only the first hardware thread of each core is kept, so that the two
+ * blur passes are not split between SMT siblings.
+ */
+static unsigned int
+usablecpus(int *cpus, unsigned int max, int physical)
+{
+	unsigned int n = 0;
+#ifdef __linux__
+	cpu_set_t set;
+	char path[64];
+	FILE *f;
+	int cpu, first;
+
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+			if (!CPU_ISSET(cpu, &set))
+				continue;
+			if (physical) {
+				snprintf(path, sizeof(path), "/sys/devices/system/cpu/"
+				         "cpu%d/topology/thread_siblings_list", cpu);
+				if ((f = fopen(path, "r"))) {
+					if (fscanf(f, "%d", &first) != 1)
+						first = cpu;
+					fclose(f);
+					if (first != cpu && CPU_ISSET(first, &set))
+						continue;
+				}
+			}
+			cpus[n++] = cpu;
+		}
+	}
+#endif
+	if (!n) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+		for (; n < max && n < online; n++)
+			cpus[n] = -1;
+	}
+	return n ? n : 1;
+}
+
+static void *
+worker(void *arg)
+{
+	unsigned int id = (unsigned int)(size_t)arg;
+	unsigned long gen = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&pool.lock);
+		while (!pool.quit && pool.gen == gen)
+			pthread_cond_wait(&pool.work, &pool.lock);
+		if (pool.quit) {
+			pthread_mutex_unlock(&pool.lock);
+			return NULL;
+		}
+		gen = pool.gen;
+		pthread_mutex_unlock(&pool.lock);
+
+		pool.fn(pool.arg, id, pool.n);
+
+		pthread_mutex_lock(&pool.lock);
+		if (--pool.pending == 0)
+			pthread_cond_signal(&pool.done);
+		pthread_mutex_unlock(&pool.lock);
+	}
+}
+
+int
+pool_init(unsigned int nthreads, int pin)
+{
+	int cpus[POOL_MAXTHREADS];
+	unsigned int i, ncpus;
+
+	if (pool.n)
+		return 0;
+	ncpus = usablecpus(cpus, POOL_MAXTHREADS, pin);
+	if (nthreads < 1)
+		nthreads = ncpus;
+	if (nthreads > POOL_MAXTHREADS)
+		nthreads = POOL_MAXTHREADS;
+	if (!(pool.threads = calloc(nthreads, sizeof(pthread_t))))
+		return -1;
+	pthread_mutex_init(&pool.run, NULL);
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.work, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	pthread_barrier_init(&pool.barrier, NULL, nthreads);
+	/* workers start at generation 0, or they would rerun the last job */
+	pool.gen = 0;
+	pool.quit = 0;
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&pool.threads[i], NULL, worker,
+		                   (void *)(size_t)i)) {
+			/* a barrier sized for n threads would deadlock */
+			pool.n = i;
+			pool_destroy();
+			return -1;
+		}
+#ifdef __linux__
+		if (pin && cpus[i % ncpus] >= 0) {
+			cpu_set_t set;
+
+			CPU_ZERO(&set);
+			CPU_SET(cpus[i % ncpus], &set);
+			pthread_setaffinity_np(pool.threads[i], sizeof(set), &set);
+		}
+#endif
+	}
+	pool.n = nthreads;
+	return 0;
+}
+
+void
+pool_run(PoolFunc fn, void *arg)
+{
+	/* without workers the caller does the job on its own */
+	if (!pool.n) {
+		fn(arg, 0, 1);
+		return;
+	}
+	pthread_mutex_lock(&pool.run);
+	pthread_mutex_lock(&pool.lock);
+	pool.fn = fn;
+	pool.arg = arg;
+	pool.pending = pool.n;
+	pool.gen++;
+	pthread_cond_broadcast(&pool.work);
+	while (pool.pending)
+		pthread_cond_wait(&pool.done, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+	pthread_mutex_unlock(&pool.run);
+}
+
+void
+pool_barrier(void)
+{
+	if (pool.n > 1)
+		pthread_barrier_wait(&pool.barrier);
+}
+
+unsigned int
+pool_size(void)
+{
+	return pool.n ? pool.n : 1;
+}
+
+void
+pool_destroy(void)
+{
+	unsigned int i;
+
+	if (!pool.threads)
+		return;
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = 1;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+	for (i = 0; i < pool.n; i++)
+		pthread_join(pool.threads[i], NULL);
+	pthread_barrier_destroy(&pool.barrier);
+	pthread_cond_destroy(&pool.done);
+	pthread_cond_destroy(&pool.work);
+	pthread_mutex_destroy(&pool.lock);
+	pthread_mutex_destroy(&pool.run);
+	free(pool.threads);
+	pool.threads = NULL;
+	pool.n = 0;
+}
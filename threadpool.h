@@ -0,0 +1,18 @@
+/* See LICENSE file for license details. */
+#ifndef THREADPOOL_H__
+#define THREADPOOL_H__
+
+#define POOL_MAXTHREADS 256
+
+/* a job runs once on every worker; id is in [0, n) */
+typedef void (*PoolFunc)(void *arg, unsigned int id, unsigned int n);
+
+/* nthreads 0: one worker per usable CPU, or per physical core with pin */
+int pool_init(unsigned int nthreads, int pin);
+/* safe to call from any thread; concurrent jobs run one after another */
+void pool_run(PoolFunc fn, void *arg);
+void pool_barrier(void);
+unsigned int pool_size(void);
+void pool_destroy(void);
+
+#endif
@@ -0,0 +1,200 @@
+/* See LICENSE file for license details. */
+#define _POSIX_C_SOURCE 200112L
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define TRACE_MAXEVENTS 65536
+
+/*
+ * Events go into a fixed array through an atomic index, so any thread
+ * can record without locking; events past the end are counted and
+ * dropped.  name must be a string literal, only the pointer is kept.
+ */
+typedef struct {
+	const char *name;
+	int screen, tid;
+	uint64_t start, end;
+} Event;
+
+static Event *events;
+static unsigned int nevents, dropped;
+static const char *output;
+static uint64_t epoch;
+static __thread int curscreen = -1;
+
+static uint64_t
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void
+trace_init(const char *out)
+{
+	if (!out || !*out)
+		return;
+	if (!(events = calloc(TRACE_MAXEVENTS, sizeof(Event)))) {
+		fprintf(stderr, "slock: cannot allocate the trace buffer\n");
+		return;
+	}
+	output = out;
+	/* keep 0 free for "tracing off" */
+	epoch = now() - 1;
+}
+
+int
+trace_enabled(void)
+{
+	return events != NULL;
+}
+
+uint64_t
+trace_now(void)
+{
+	return events ? now() - epoch : 0;
+}
+
+void
+trace_add(const char *name, int screen, int tid, uint64_t start)
+{
+	unsigned int i;
+
+	if (!events)
+		return;
+	i = __atomic_fetch_add(&nevents, 1, __ATOMIC_RELAXED);
+	if (i >= TRACE_MAXEVENTS) {
+		__atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	events[i].name = name;
+	events[i].screen = screen;
+	events[i].tid = tid;
+	events[i].start = start;
+	events[i].end = now() - epoch;
+}
+
+void
+trace_setscreen(int screen)
+{
+	curscreen = screen;
+}
+
+int
+trace_screen(void)
+{
+	return curscreen;
+}
+
+static const char *
+threadname(int tid, char *buf, size_t len)
+{
+	switch (tid) {
+	case TRACE_MAIN:
+		return "main";
+	case TRACE_REFINER:
+		return "refiner";
+	case TRACE_AUTH:
+		return "auth";
+	}
+	snprintf(buf, len, "worker %d", tid - TRACE_WORKER);
+	return buf;
+}
+
+static void
+writejson(FILE *f, unsigned int n)
+{
+	unsigned int i, j;
+	char buf[32];
+
+	fputs("{\"traceEvents\":[\n", f);
+	for (i = 0; i < n; i++) {
+		fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,"
+		        "\"ts\":%llu,\"dur\":%llu,\"args\":{\"screen\":%d}},\n",
+		        events[i].name, events[i].tid,
+		        (unsigned long long)events[i].start,
+		        (unsigned long long)(events[i].end - events[i].start),
+		        events[i].screen);
+	}
+	/* name each thread once */
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < i && events[j].tid != events[i].tid; j++)
+			;
+		if (j < i)
+			continue;
+		fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+		        "\"tid\":%d,\"args\":{\"name\":\"%s\"}},\n", events[i].tid,
+		        threadname(events[i].tid, buf, sizeof(buf)));
+	}
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+	        "\"args\":{\"name\":\"slock\"}}\n]}\n");
+}
+
+/* one line per phase, screen and thread, in order of first appearance */
+static void
+writesummary(FILE *f, unsigned int n)
+{
+	unsigned int i, j, count;
+	uint64_t total, max, d;
+	char *done, buf[32];
+
+	if (!(done = calloc(n, 1)))
+		return;
+	fprintf(f, "slock: %-8s %6s %-10s %5s %10s %10s\n", "phase", "screen",
+	        "thread", "count", "total ms", "max ms");
+	for (i = 0; i < n; i++) {
+		if (done[i])
+			continue;
+		count = 0;
+		total = max = 0;
+		for (j = i; j < n; j++) {
+			if (done[j] || strcmp(events[j].name, events[i].name) ||
+			    events[j].screen != events[i].screen ||
+			    events[j].tid != events[i].tid)
+				continue;
+			done[j] = 1;
+			d = events[j].end - events[j].start;
+			count++;
+			total += d;
+			if (d > max)
+				max = d;
+		}
+		fprintf(f, "slock: %-8s %6d %-10s %5u %10.3f %10.3f\n",
+		        events[i].name, events[i].screen,
+		        threadname(events[i].tid, buf, sizeof(buf)), count,
+		        total / 1000.0, max / 1000.0);
+	}
+	free(done);
+}
+
+void
+trace_dump(void)
+{
+	unsigned int n;
+	FILE *f;
+
+	if (!events)
+		return;
+	n = __atomic_load_n(&nevents, __ATOMIC_RELAXED);
+	if (n > TRACE_MAXEVENTS)
+		n = TRACE_MAXEVENTS;
+	if (!strcmp(output, "-")) {
+		writesummary(stderr, n);
+	} else if ((f = fopen(output, "w"))) {
+		writejson(f, n);
+		fclose(f);
+	} else {
+		fprintf(stderr, "slock: cannot write trace to %s\n", output);
+	}
+	if (dropped)
+		fprintf(stderr, "slock: trace buffer full, %u events dropped\n",
+		        dropped);
+	nevents = dropped = 0;
+}
@@ -0,0 +1,39 @@
+/* See LICENSE file for license details. */
+#ifndef TRACE_H__
+#define TRACE_H__
+
+#include <stdint.h>
+
+/* thread ids in traces; pool worker n is TRACE_WORKER + n */
+enum {
+	TRACE_MAIN,
+	TRACE_REFINER,
+	TRACE_AUTH,
+	TRACE_WORKER = 16
+};
+
+/*
+ * out is "-" for a per phase summary on stderr, or the path of a Chrome
+ * trace (chrome://tracing, Perfetto) written by trace_dump().  NULL or ""
+ * leaves tracing off, which makes the calls below nearly free.
+ */
+void trace_init(const char *out);
+int trace_enabled(void);
+
+/* monotonic microseconds, 0 while tracing is off */
+uint64_t trace_now(void);
+
+/* records phase name on screen (-1 for none) from start until now */
+void trace_add(const char *name, int screen, int tid, uint64_t start);
+
+/*
+ * The screen the calling thread works on, -1 until set.  Pool jobs take
+ * it from the thread that runs them, so workers record the right one.
+ */
+void trace_setscreen(int screen);
+int trace_screen(void);
+
+/* writes out what was recorded since the last dump */
+void trace_dump(void);
+
+#endif
@@ -1,2 +1,10 @@
+#ifndef UTIL_H__
+#define UTIL_H__
+
 #undef explicit_bzero
 void explicit_bzero(void *, size_t);
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+#endif